@@ -0,0 +1,28 @@
+#version 330 core
+
+in vec3 in_pos;
+in vec2 in_uv;
+in vec3 in_light;
+in float in_layer;
+
+layout (std140) uniform Matrices {
+	mat4 proj;
+	mat4 view;
+};
+// Corner of the chunk, mesh positions are relative to it
+uniform vec3 origin;
+
+out VS_OUT {
+	vec2 uv;
+	float id;
+	float shade;
+} vs_out;
+
+void main() {
+	gl_Position = proj * view * vec4(origin + in_pos, 1.0);
+	vs_out.uv = in_uv;
+	vs_out.id = in_layer;
+	// Light comes in as the sum of 4 levels, ao from 0 (covered) to 3
+	float level = max(in_light.x, in_light.y) / 4.0;
+	vs_out.shade = pow(0.8, 15.0 - level) * (0.4 + 0.2 * in_light.z);
+}
@@ -7,8 +7,10 @@ uniform sampler2DArray diffuse;
 in VS_OUT {
 	vec2 uv;
 	float id;
+	float shade;
 } fs_in;
 
 void main() {
-	FragColor = texture(diffuse, vec3(fs_in.uv, fs_in.id));
+	vec4 color = texture(diffuse, vec3(fs_in.uv, fs_in.id));
+	FragColor = vec4(color.rgb * fs_in.shade, color.a);
 }
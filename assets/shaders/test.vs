@@ -12,11 +12,12 @@ layout (std140) uniform Matrices {
 out VS_OUT {
 	vec2 uv;
 	float id;
+	float shade;
 } vs_out;
 
 void main() {
 	gl_Position = proj * view * in_model * vec4(in_pos, 1.0);
 	vs_out.uv = in_uv;
 	vs_out.id = gl_InstanceID;
+	vs_out.shade = 1.0;
 }
-
@@ -0,0 +1,26 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "system.h"
+
+struct BenchSuite {
+    const char *name;
+    void (*run)(void);
+};
+
+// Results are printed as csv (suite,name,ops,ns_per_op,mb_per_s,rss_kib) instead
+extern bool bench_csv;
+
+// Prints one result line. bytes can be 0 for benchmarks without a throughput.
+void bench_report(const char *suite, const char *name, size_t ops, size_t bytes, double seconds);
+// Resident set size of the process in KiB, 0 where it can't be found out
+size_t bench_rss_kib(void);
+
+void bench_lz(void);
+void bench_mem(void);
+// Lighting, meshing and streaming, run it once per section layout to compare them
+void bench_world(void);
+
+#endif
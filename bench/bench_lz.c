@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "lz.h"
+#include "mem.h"
+
+#define BENCH_SECTIONS 256
+#define BENCH_SECTION_BLOCKS (16 * 16 * 16)
+#define BENCH_MIN_TIME 0.25
+
+static uint32_t rng_state = 0x12345678;
+static uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Palette indexed sections that look like terrain: stone with some ores,
+// a few dirt layers, grass and then air above a wavy surface
+static void gen_terrain(uint16_t *blocks) {
+    for (size_t s = 0; s < BENCH_SECTIONS; s++) {
+        int base_y = (int)(s % 16) * 16;
+        for (int y = 0; y < 16; y++) {
+            for (int z = 0; z < 16; z++) {
+                for (int x = 0; x < 16; x++) {
+                    int height = 64 + (x * 7 + z * 3 + (int)s) % 9;
+                    int wy = base_y + y;
+                    uint16_t id = 0;
+                    if (wy < height - 4) {
+                        id = rng_next() % 64 == 0 ? 4 + rng_next() % 4 : 1;
+                    } else if (wy < height - 1) {
+                        id = 2;
+                    } else if (wy < height) {
+                        id = 3;
+                    }
+                    blocks[s * BENCH_SECTION_BLOCKS + x + z * 16 + y * 256] = id;
+                }
+            }
+        }
+    }
+}
+static void gen_noise(uint16_t *blocks) {
+    for (size_t i = 0; i < BENCH_SECTIONS * BENCH_SECTION_BLOCKS; i++) {
+        blocks[i] = rng_next();
+    }
+}
+
+static void bench_dataset(const char *dataset, const uint16_t *blocks, struct Arena *arena) {
+    const size_t size = BENCH_SECTIONS * BENCH_SECTION_BLOCKS * sizeof(uint16_t);
+    const size_t section_size = BENCH_SECTION_BLOCKS * sizeof(uint16_t);
+    uint8_t *raw = mem_alloc(size);
+    uint8_t *packed = mem_alloc(LZ_COMPRESS_BOUND(section_size) * BENCH_SECTIONS);
+    size_t packed_sizes[BENCH_SECTIONS], packed_total = 0;
+    char name[64];
+    size_t iters;
+    double start, elapsed;
+
+    // Raw baseline: what saving/sending the data uncompressed costs
+    iters = 0;
+    start = get_time();
+    do {
+        memcpy(raw, blocks, size);
+        iters++;
+    } while ((elapsed = get_time() - start) < BENCH_MIN_TIME);
+    snprintf(name, sizeof(name), "%s/memcpy", dataset);
+    bench_report("lz", name, iters, iters * size, elapsed);
+
+    // Per section, how chunk saves and cold chunks use it
+    iters = 0;
+    start = get_time();
+    do {
+        packed_total = 0;
+        for (size_t s = 0; s < BENCH_SECTIONS; s++) {
+            uint8_t *dest = packed + s * LZ_COMPRESS_BOUND(section_size);
+            packed_sizes[s] = lz_compress((const uint8_t *)blocks + s * section_size, section_size,
+                                            dest, LZ_COMPRESS_BOUND(section_size));
+            assert(packed_sizes[s]);
+            packed_total += packed_sizes[s];
+        }
+        iters++;
+    } while ((elapsed = get_time() - start) < BENCH_MIN_TIME);
+    snprintf(name, sizeof(name), "%s/compress", dataset);
+    bench_report("lz", name, iters * BENCH_SECTIONS, iters * size, elapsed);
+
+    iters = 0;
+    start = get_time();
+    do {
+        for (size_t s = 0; s < BENCH_SECTIONS; s++) {
+            const uint8_t *src = packed + s * LZ_COMPRESS_BOUND(section_size);
+            size_t n = lz_decompress(src, packed_sizes[s], raw + s * section_size, section_size);
+            assert(n == section_size);
+        }
+        iters++;
+    } while ((elapsed = get_time() - start) < BENCH_MIN_TIME);
+    snprintf(name, sizeof(name), "%s/decompress", dataset);
+    bench_report("lz", name, iters * BENCH_SECTIONS, iters * size, elapsed);
+    if (memcmp(raw, blocks, size) != 0) {
+        printf("lz %s: round trip mismatch!\n", dataset);
+    }
+
+    // Whole buffer through the arena backed stream API
+    iters = 0;
+    size_t stream_size;
+    start = get_time();
+    do {
+        struct LzWriter writer;
+        arena_reset(arena);
+        lz_writer_begin(&writer, arena);
+        lz_writer_write(&writer, blocks, size);
+        lz_writer_end(&writer, &stream_size);
+        iters++;
+    } while ((elapsed = get_time() - start) < BENCH_MIN_TIME);
+    snprintf(name, sizeof(name), "%s/stream_write", dataset);
+    bench_report("lz", name, iters, iters * size, elapsed);
+
+    struct LzWriter writer;
+    arena_reset(arena);
+    lz_writer_begin(&writer, arena);
+    lz_writer_write(&writer, blocks, size);
+    uint8_t *stream = lz_writer_end(&writer, &stream_size);
+    iters = 0;
+    start = get_time();
+    do {
+        struct LzReader reader;
+        lz_reader_begin(&reader, arena, stream, stream_size);
+        size_t n = lz_reader_read(&reader, raw, size);
+        assert(n == size && !reader.corrupt);
+        iters++;
+    } while ((elapsed = get_time() - start) < BENCH_MIN_TIME);
+    snprintf(name, sizeof(name), "%s/stream_read", dataset);
+    bench_report("lz", name, iters, iters * size, elapsed);
+
+    if (!bench_csv) {
+        printf("lz       %s ratio: sections %.2f%%, stream %.2f%%\n", dataset,
+                (double)packed_total * 100.0 / (double)size,
+                (double)stream_size * 100.0 / (double)size);
+    }
+
+    mem_free(packed);
+    mem_free(raw);
+}
+
+void bench_lz(void) {
+    uint16_t *blocks = mem_alloc(BENCH_SECTIONS * BENCH_SECTION_BLOCKS * sizeof(uint16_t));
+    struct Arena *arena = arena_create(1024 * 1024);
+
+    gen_terrain(blocks);
+    bench_dataset("terrain", blocks, arena);
+    memset(blocks, 0, BENCH_SECTIONS * BENCH_SECTION_BLOCKS * sizeof(uint16_t));
+    bench_dataset("air", blocks, arena);
+    gen_noise(blocks);
+    bench_dataset("noise", blocks, arena);
+
+    arena_destroy(arena);
+    mem_free(blocks);
+}
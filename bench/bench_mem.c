@@ -0,0 +1,488 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <SDL.h>
+
+#include "bench.h"
+#include "mem.h"
+#include "slab.h"
+
+// Blocks alive at once in one round of a pattern
+#define BENCH_BLOCKS 4096
+#define BENCH_MEM_TIME 0.1
+#define BENCH_MAX_THREADS 4
+// Blocks in flight between the two threads of a cross thread run
+#define BENCH_RING_SIZE 1024
+// Blocks a shared pool orphan round takes, enough for a few chunks
+#define BENCH_ORPHAN_BLOCKS 256
+
+enum BenchPattern {
+    // Freed in reverse order of allocation
+    BENCH_LIFO,
+    // Freed in the order they were allocated
+    BENCH_FIFO,
+    BENCH_RANDOM,
+};
+static const char *const pattern_names[] = { "lifo", "fifo", "random" };
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, 4096 };
+// Thread scaling and cross thread runs only use these, the rest take too long
+static const size_t bench_thread_sizes[] = { 64, 1024 };
+
+struct BenchAllocator {
+    const char *name;
+    // Everything from ctx can be freed by any thread
+    bool thread_safe;
+    // NULL for allocators that don't need anything per size
+    void *(*create)(size_t size);
+    void (*destroy)(void *ctx);
+    void *(*alloc)(void *ctx, size_t size);
+    void (*free)(void *ctx, void *block);
+    // Called by every bench thread before it exits, can be NULL
+    void (*thread_exit)(void *ctx);
+};
+
+static void *malloc_alloc(void *ctx, size_t size) {
+    return mem_alloc(size);
+}
+static void malloc_free(void *ctx, void *block) {
+    mem_free(block);
+}
+
+static void *slab_bench_alloc(void *ctx, size_t size) {
+    return slab_alloc(size);
+}
+static void slab_bench_free(void *ctx, void *block) {
+    slab_free(block);
+}
+static void slab_bench_thread_exit(void *ctx) {
+    slab_thread_shutdown();
+}
+
+static void *pool_bench_create(size_t size) {
+    return pool_create(BENCH_BLOCKS, size, true);
+}
+static void pool_bench_destroy(void *ctx) {
+    pool_destroy(ctx);
+}
+static void *pool_bench_alloc(void *ctx, size_t size) {
+    return pool_alloc(ctx);
+}
+static void pool_bench_free(void *ctx, void *block) {
+    pool_free(ctx, block);
+}
+
+static void *shared_pool_bench_create(size_t size) {
+    return shared_pool_create(BENCH_BLOCKS, size);
+}
+static void shared_pool_bench_destroy(void *ctx) {
+    shared_pool_destroy(ctx);
+}
+static void *shared_pool_bench_alloc(void *ctx, size_t size) {
+    return shared_pool_alloc(ctx);
+}
+static void shared_pool_bench_free(void *ctx, void *block) {
+    shared_pool_free(ctx, block);
+}
+static void shared_pool_bench_thread_exit(void *ctx) {
+    shared_pool_thread_release(ctx);
+}
+
+static const struct BenchAllocator allocators[] = {
+    {
+        .name = "malloc",
+        .thread_safe = true,
+        .alloc = malloc_alloc,
+        .free = malloc_free,
+    },
+    {
+        .name = "slab",
+        .thread_safe = true,
+        .alloc = slab_bench_alloc,
+        .free = slab_bench_free,
+        .thread_exit = slab_bench_thread_exit,
+    },
+    {
+        .name = "pool",
+        .thread_safe = false,
+        .create = pool_bench_create,
+        .destroy = pool_bench_destroy,
+        .alloc = pool_bench_alloc,
+        .free = pool_bench_free,
+    },
+    {
+        .name = "shared_pool",
+        .thread_safe = true,
+        .create = shared_pool_bench_create,
+        .destroy = shared_pool_bench_destroy,
+        .alloc = shared_pool_bench_alloc,
+        .free = shared_pool_bench_free,
+        .thread_exit = shared_pool_bench_thread_exit,
+    },
+};
+
+struct BenchWorker {
+    const struct BenchAllocator *allocator;
+    void *ctx;
+    size_t size;
+    enum BenchPattern pattern;
+    uint32_t seed;
+    // Alloc/free pairs done
+    size_t ops;
+};
+struct BenchRun {
+    atomic_uint ready;
+    atomic_bool go, stop;
+};
+static struct BenchRun bench_run;
+
+// One round: allocate BENCH_BLOCKS blocks, touch them and free them in pattern order
+static void bench_round(struct BenchWorker *worker, void **blocks, const uint32_t *order) {
+    const struct BenchAllocator *a = worker->allocator;
+    for (size_t i = 0; i < BENCH_BLOCKS; i++) {
+        blocks[i] = a->alloc(worker->ctx, worker->size);
+        assert(blocks[i] && "Out of memory!");
+        *(volatile uint8_t *)blocks[i] = (uint8_t)i;
+    }
+    switch (worker->pattern) {
+    case BENCH_LIFO:
+        for (size_t i = BENCH_BLOCKS; i-- > 0;) {
+            a->free(worker->ctx, blocks[i]);
+        }
+        break;
+    case BENCH_FIFO:
+        for (size_t i = 0; i < BENCH_BLOCKS; i++) {
+            a->free(worker->ctx, blocks[i]);
+        }
+        break;
+    case BENCH_RANDOM:
+        for (size_t i = 0; i < BENCH_BLOCKS; i++) {
+            a->free(worker->ctx, blocks[order[i]]);
+        }
+        break;
+    }
+    worker->ops += BENCH_BLOCKS;
+}
+static void bench_shuffle(uint32_t *order, uint32_t seed) {
+    for (uint32_t i = 0; i < BENCH_BLOCKS; i++) {
+        order[i] = i;
+    }
+    for (uint32_t i = BENCH_BLOCKS - 1; i > 0; i--) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uint32_t j = seed % (i + 1), t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+static int bench_worker_thread(void *data) {
+    struct BenchWorker *worker = data;
+    void **blocks = mem_alloc(sizeof(void *) * BENCH_BLOCKS);
+    uint32_t *order = mem_alloc(sizeof(uint32_t) * BENCH_BLOCKS);
+    assert(blocks && order && "Out of memory!");
+    bench_shuffle(order, worker->seed);
+
+    atomic_fetch_add(&bench_run.ready, 1);
+    while (!atomic_load(&bench_run.go)) {
+        SDL_Delay(0);
+    }
+    while (!atomic_load(&bench_run.stop)) {
+        bench_round(worker, blocks, order);
+    }
+
+    if (worker->allocator->thread_exit) {
+        worker->allocator->thread_exit(worker->ctx);
+    }
+    mem_free(order);
+    mem_free(blocks);
+    mem_thread_shutdown();
+    return 0;
+}
+
+// Starts the threads together, lets them run for BENCH_MEM_TIME and returns
+// the wall clock time it took
+static double bench_threads(SDL_ThreadFunction func, void *data, size_t data_stride, int num_threads,
+                            SDL_Thread **threads) {
+    atomic_store(&bench_run.ready, 0);
+    atomic_store(&bench_run.go, false);
+    atomic_store(&bench_run.stop, false);
+    for (int i = 0; i < num_threads; i++) {
+        threads[i] = SDL_CreateThread(func, "bench", (uint8_t *)data + i * data_stride);
+        assert(threads[i]);
+    }
+    while (atomic_load(&bench_run.ready) < (unsigned)num_threads) {
+        SDL_Delay(0);
+    }
+
+    double start = get_time();
+    atomic_store(&bench_run.go, true);
+    SDL_Delay((uint32_t)(BENCH_MEM_TIME * 1000.0));
+    atomic_store(&bench_run.stop, true);
+    for (int i = 0; i < num_threads; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+    return get_time() - start;
+}
+
+// Single threaded runs happen on the main thread, ns/op is per alloc/free pair
+static void bench_pattern(const struct BenchAllocator *a, size_t size, enum BenchPattern pattern) {
+    struct BenchWorker worker = (struct BenchWorker) {
+        .allocator = a,
+        .ctx = a->create ? a->create(size) : NULL,
+        .size = size,
+        .pattern = pattern,
+        .ops = 0,
+    };
+    void **blocks = mem_alloc(sizeof(void *) * BENCH_BLOCKS);
+    uint32_t *order = mem_alloc(sizeof(uint32_t) * BENCH_BLOCKS);
+    assert(blocks && order && "Out of memory!");
+    bench_shuffle(order, 0x9E3779B9);
+
+    // Warm up so the first round doesn't pay for growing the allocator
+    bench_round(&worker, blocks, order);
+    worker.ops = 0;
+    double start = get_time(), elapsed;
+    do {
+        bench_round(&worker, blocks, order);
+    } while ((elapsed = get_time() - start) < BENCH_MEM_TIME);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%zu/%s", a->name, size, pattern_names[pattern]);
+    bench_report("mem", name, worker.ops, 0, elapsed);
+
+    mem_free(order);
+    mem_free(blocks);
+    if (a->destroy) {
+        a->destroy(worker.ctx);
+    }
+}
+
+// Every thread does its own LIFO rounds on the same allocator, ns/op is wall
+// clock time over the pairs done by all threads together
+static void bench_scaling(const struct BenchAllocator *a, size_t size, int num_threads) {
+    struct BenchWorker workers[BENCH_MAX_THREADS];
+    SDL_Thread *threads[BENCH_MAX_THREADS];
+    void *ctx = a->create ? a->create(size) : NULL;
+    for (int i = 0; i < num_threads; i++) {
+        workers[i] = (struct BenchWorker) {
+            .allocator = a,
+            .ctx = ctx,
+            .size = size,
+            .pattern = BENCH_LIFO,
+            .seed = 0x9E3779B9 + i,
+            .ops = 0,
+        };
+    }
+    double elapsed = bench_threads(bench_worker_thread, workers, sizeof(struct BenchWorker),
+                                    num_threads, threads);
+
+    size_t ops = 0;
+    for (int i = 0; i < num_threads; i++) {
+        ops += workers[i].ops;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%zu/lifo/%dt", a->name, size, num_threads);
+    bench_report("mem", name, ops, 0, elapsed);
+    if (a->destroy) {
+        a->destroy(ctx);
+    }
+}
+
+// One thread allocates, the other frees everything it gets sent
+struct BenchCross {
+    const struct BenchAllocator *allocator;
+    void *ctx;
+    size_t size;
+    void *ring[BENCH_RING_SIZE];
+    atomic_size_t head, tail;
+    atomic_bool producer_done;
+    size_t ops;
+};
+struct BenchCrossThread {
+    struct BenchCross *cross;
+    bool producer;
+};
+static int bench_cross_thread(void *data) {
+    struct BenchCrossThread *me = data;
+    struct BenchCross *cross = me->cross;
+    const struct BenchAllocator *a = cross->allocator;
+
+    atomic_fetch_add(&bench_run.ready, 1);
+    while (!atomic_load(&bench_run.go)) {
+        SDL_Delay(0);
+    }
+    if (me->producer) {
+        while (!atomic_load(&bench_run.stop)) {
+            size_t head = atomic_load_explicit(&cross->head, memory_order_relaxed);
+            if (head - atomic_load_explicit(&cross->tail, memory_order_acquire) == BENCH_RING_SIZE) {
+                // Give the other thread the core if there's only one
+                SDL_Delay(0);
+                continue;
+            }
+            void *block = a->alloc(cross->ctx, cross->size);
+            assert(block && "Out of memory!");
+            *(volatile uint8_t *)block = (uint8_t)head;
+            cross->ring[head % BENCH_RING_SIZE] = block;
+            atomic_store_explicit(&cross->head, head + 1, memory_order_release);
+        }
+        atomic_store(&cross->producer_done, true);
+    } else {
+        for (;;) {
+            bool done = atomic_load(&cross->producer_done);
+            size_t tail = atomic_load_explicit(&cross->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&cross->head, memory_order_acquire)) {
+                if (done) {
+                    break;
+                }
+                SDL_Delay(0);
+                continue;
+            }
+            a->free(cross->ctx, cross->ring[tail % BENCH_RING_SIZE]);
+            atomic_store_explicit(&cross->tail, tail + 1, memory_order_release);
+            cross->ops++;
+        }
+    }
+
+    if (a->thread_exit) {
+        a->thread_exit(cross->ctx);
+    }
+    mem_thread_shutdown();
+    return 0;
+}
+static void bench_cross(const struct BenchAllocator *a, size_t size) {
+    struct BenchCross *cross = mem_alloc(sizeof(struct BenchCross));
+    assert(cross && "Out of memory!");
+    cross->allocator = a;
+    cross->ctx = a->create ? a->create(size) : NULL;
+    cross->size = size;
+    atomic_init(&cross->head, 0);
+    atomic_init(&cross->tail, 0);
+    atomic_init(&cross->producer_done, false);
+    cross->ops = 0;
+
+    struct BenchCrossThread me[2] = {
+        { .cross = cross, .producer = true, },
+        { .cross = cross, .producer = false, },
+    };
+    SDL_Thread *threads[2];
+    double elapsed = bench_threads(bench_cross_thread, me, sizeof(me[0]), 2, threads);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%zu/cross", a->name, size);
+    bench_report("mem", name, cross->ops, 0, elapsed);
+    if (a->destroy) {
+        a->destroy(cross->ctx);
+    }
+    mem_free(cross);
+}
+
+// Both threads allocate (adopting each other's orphans), free, trim and
+// release their chunks in a loop, so pops race with trims of the chunks
+// they're reading. Mostly there to break if that ever stops being safe.
+struct BenchOrphan {
+    struct SharedPool *pool;
+    size_t ops;
+};
+static int bench_orphan_thread(void *data) {
+    struct BenchOrphan *me = data;
+    void *blocks[BENCH_ORPHAN_BLOCKS];
+
+    atomic_fetch_add(&bench_run.ready, 1);
+    while (!atomic_load(&bench_run.go)) {
+        SDL_Delay(0);
+    }
+    while (!atomic_load(&bench_run.stop)) {
+        for (size_t i = 0; i < BENCH_ORPHAN_BLOCKS; i++) {
+            blocks[i] = shared_pool_alloc(me->pool);
+            *(void **volatile *)blocks[i] = &blocks[i];
+        }
+        for (size_t i = 0; i < BENCH_ORPHAN_BLOCKS; i++) {
+            // Nobody else got handed the same block
+            assert(*(void **volatile *)blocks[i] == &blocks[i]);
+            shared_pool_free(me->pool, blocks[i]);
+        }
+        shared_pool_thread_trim(me->pool, 0);
+        shared_pool_thread_release(me->pool);
+        me->ops += BENCH_ORPHAN_BLOCKS;
+    }
+    mem_thread_shutdown();
+    return 0;
+}
+static void bench_orphans(size_t size) {
+    struct BenchOrphan me[2];
+    SDL_Thread *threads[2];
+    struct SharedPool *pool = shared_pool_create(64, size);
+    for (int i = 0; i < 2; i++) {
+        me[i] = (struct BenchOrphan) {
+            .pool = pool,
+            .ops = 0,
+        };
+    }
+    double elapsed = bench_threads(bench_orphan_thread, me, sizeof(me[0]), 2, threads);
+
+    char name[64];
+    snprintf(name, sizeof(name), "shared_pool/%zu/orphan_trim/2t", size);
+    bench_report("mem", name, me[0].ops + me[1].ops, 0, elapsed);
+    shared_pool_destroy(pool);
+}
+
+// Arenas don't free blocks, a round is BENCH_BLOCKS allocations then a reset
+static void bench_arenas(size_t size) {
+    struct Arena *arena = arena_create(BENCH_BLOCKS * size);
+    struct VmArena *vm = vm_arena_create((size_t)1 << 30, BENCH_BLOCKS * size);
+    assert(vm);
+    char name[64];
+    size_t ops = 0;
+    double start = get_time(), elapsed;
+    do {
+        for (size_t i = 0; i < BENCH_BLOCKS; i++) {
+            *(volatile uint8_t *)arena_alloc(arena, size) = (uint8_t)i;
+        }
+        arena_reset(arena);
+        ops += BENCH_BLOCKS;
+    } while ((elapsed = get_time() - start) < BENCH_MEM_TIME);
+    snprintf(name, sizeof(name), "arena/%zu/reset", size);
+    bench_report("mem", name, ops, 0, elapsed);
+
+    ops = 0;
+    start = get_time();
+    do {
+        for (size_t i = 0; i < BENCH_BLOCKS; i++) {
+            *(volatile uint8_t *)vm_arena_alloc(vm, size) = (uint8_t)i;
+        }
+        vm_arena_reset(vm);
+        ops += BENCH_BLOCKS;
+    } while ((elapsed = get_time() - start) < BENCH_MEM_TIME);
+    snprintf(name, sizeof(name), "vm_arena/%zu/reset", size);
+    bench_report("mem", name, ops, 0, elapsed);
+
+    vm_arena_destroy(vm);
+    arena_destroy(arena);
+}
+
+void bench_mem(void) {
+    slab_init();
+    for (size_t s = 0; s < ARRAY_SIZE(bench_sizes); s++) {
+        bench_arenas(bench_sizes[s]);
+        for (size_t i = 0; i < ARRAY_SIZE(allocators); i++) {
+            for (int p = BENCH_LIFO; p <= BENCH_RANDOM; p++) {
+                bench_pattern(&allocators[i], bench_sizes[s], p);
+            }
+        }
+    }
+    for (size_t s = 0; s < ARRAY_SIZE(bench_thread_sizes); s++) {
+        for (size_t i = 0; i < ARRAY_SIZE(allocators); i++) {
+            if (!allocators[i].thread_safe) {
+                continue;
+            }
+            for (int t = 2; t <= BENCH_MAX_THREADS; t *= 2) {
+                bench_scaling(&allocators[i], bench_thread_sizes[s], t);
+            }
+            bench_cross(&allocators[i], bench_thread_sizes[s]);
+        }
+        bench_orphans(bench_thread_sizes[s]);
+    }
+    slab_thread_shutdown();
+    slab_shutdown();
+}
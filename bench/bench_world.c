@@ -0,0 +1,340 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "lod.h"
+#include "mem.h"
+#include "mesh.h"
+#include "padded.h"
+#include "stream.h"
+#include "world.h"
+
+// Chunks along each side of the benchmark world
+#define BENCH_WORLD_SIZE 8
+#define BENCH_EDITS 256
+// Edits relit together in one light_update by the light check
+#define BENCH_CHECK_EDITS 16
+// Batches between checks of the whole world, a check takes a while
+#define BENCH_CHECK_EVERY 256
+#define BENCH_WORLD_TIME 0.25
+#define BENCH_VIEW_DISTANCE 8
+// Blocks per second, well past what the streamer keeps up with
+#define BENCH_FLY_SPEED 100.0f
+
+static uint32_t rng_state = 0x9E3779B9;
+static uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Rolling stone and dirt with grass on top, caves with torches in them,
+// lakes in the dips and the odd leaf canopy
+static void gen_chunk(struct World *world, struct Chunk *chunk) {
+    for (int z = 0; z < CHUNK_WIDTH; z++) {
+        for (int x = 0; x < CHUNK_WIDTH; x++) {
+            const int32_t wx = chunk->x * CHUNK_WIDTH + x, wz = chunk->z * CHUNK_WIDTH + z;
+            const int height = 60 + (int)((wx * 7 + wz * 13) % 23 + (wx * wz) % 5);
+            for (int y = 0; y < CHUNK_HEIGHT; y++) {
+                BlockId id = BLOCK_AIR;
+                if (y < height - 4) {
+                    id = rng_next() % 64 == 0 ? BLOCK_COAL_ORE : BLOCK_STONE;
+                    if (y > 20 && y < 40 && (wx + wz * 3 + y * 5) % 7 < 3) {
+                        id = rng_next() % 97 == 0 ? BLOCK_TORCH : BLOCK_AIR;
+                    }
+                } else if (y < height - 1) {
+                    id = BLOCK_DIRT;
+                } else if (y < height) {
+                    id = BLOCK_GRASS;
+                } else if (y < 66) {
+                    id = BLOCK_WATER;
+                } else if (y > height + 4 && y < height + 7 && (wx / 4 + wz / 4) % 5 == 0) {
+                    id = BLOCK_LEAVES;
+                }
+                if (id != BLOCK_AIR) {
+                    struct Section *section = chunk_get_writable_section(world, chunk, y / SECTION_HEIGHT);
+                    section->blocks[section_block_index(x, y % SECTION_HEIGHT, z)] = id;
+                }
+            }
+        }
+    }
+    chunk_compact(world, chunk);
+    chunk_build_heightmaps(chunk);
+}
+
+static void bench_light_init(struct World *world) {
+    char name[64];
+    size_t ops = 0;
+    double start = get_time(), elapsed;
+    do {
+        for (int z = 0; z < BENCH_WORLD_SIZE; z++) {
+            for (int x = 0; x < BENCH_WORLD_SIZE; x++) {
+                light_chunk_init(world, world_get_chunk(world, x, z));
+            }
+        }
+        ops += BENCH_WORLD_SIZE * BENCH_WORLD_SIZE;
+    } while ((elapsed = get_time() - start) < BENCH_WORLD_TIME);
+    snprintf(name, sizeof(name), "light_chunk_init/%s", SECTION_LAYOUT_NAME);
+    bench_report("world", name, ops, 0, elapsed);
+}
+
+// Digs and refills spots all over the world, relighting after every edit.
+// Each round puts everything back the way it was.
+static void bench_light_edits(struct World *world) {
+    int32_t edits[BENCH_EDITS][3];
+    BlockId old[BENCH_EDITS];
+    for (int i = 0; i < BENCH_EDITS; i++) {
+        edits[i][0] = rng_next() % (BENCH_WORLD_SIZE * CHUNK_WIDTH);
+        edits[i][1] = 20 + rng_next() % 60;
+        edits[i][2] = rng_next() % (BENCH_WORLD_SIZE * CHUNK_WIDTH);
+        old[i] = world_get_block(world, edits[i][0], edits[i][1], edits[i][2]);
+    }
+
+    char name[64];
+    size_t ops = 0;
+    double start = get_time(), elapsed;
+    do {
+        for (int i = 0; i < BENCH_EDITS; i++) {
+            BlockId id = old[i] == BLOCK_AIR ? (i % 4 == 0 ? BLOCK_TORCH : BLOCK_STONE) : BLOCK_AIR;
+            world_set_block(world, edits[i][0], edits[i][1], edits[i][2], id);
+            light_update(world);
+        }
+        for (int i = BENCH_EDITS - 1; i >= 0; i--) {
+            world_set_block(world, edits[i][0], edits[i][1], edits[i][2], old[i]);
+            light_update(world);
+        }
+        ops += BENCH_EDITS * 2;
+    } while ((elapsed = get_time() - start) < BENCH_WORLD_TIME);
+    snprintf(name, sizeof(name), "light_edit/%s", SECTION_LAYOUT_NAME);
+    bench_report("world", name, ops, 0, elapsed);
+}
+
+// Random batches of edits, each relit with one light_update. Every so
+// often the whole world has to be at the fixpoint, and at the end it has
+// to match relighting every chunk from scratch. ns/op is per batch, the
+// checks aren't timed.
+static size_t light_check_world(struct World *world) {
+    size_t wrong = 0;
+    for (int z = 0; z < BENCH_WORLD_SIZE; z++) {
+        for (int x = 0; x < BENCH_WORLD_SIZE; x++) {
+            wrong += light_check_chunk(world, world_get_chunk(world, x, z));
+        }
+    }
+    return wrong;
+}
+static void bench_light_check(struct World *world) {
+    static const BlockId ids[] = {
+        BLOCK_AIR, BLOCK_AIR, BLOCK_STONE, BLOCK_TORCH, BLOCK_GLOWSTONE, BLOCK_GLASS, BLOCK_WATER, BLOCK_LEAVES,
+    };
+    const size_t chunk_blocks = CHUNK_WIDTH * CHUNK_WIDTH * CHUNK_HEIGHT;
+    size_t wrong = 0;
+
+    char name[64];
+    size_t ops = 0;
+    double elapsed = 0.0;
+    do {
+        const double start = get_time();
+        for (int i = 0; i < BENCH_CHECK_EDITS; i++) {
+            world_set_block(world, rng_next() % (BENCH_WORLD_SIZE * CHUNK_WIDTH), 20 + rng_next() % 80,
+                            rng_next() % (BENCH_WORLD_SIZE * CHUNK_WIDTH), ids[rng_next() % ARRAY_SIZE(ids)]);
+        }
+        light_update(world);
+        elapsed += get_time() - start;
+        if (++ops % BENCH_CHECK_EVERY == 0) {
+            wrong += light_check_world(world);
+        }
+    } while (elapsed < BENCH_WORLD_TIME);
+    wrong += light_check_world(world);
+
+    uint8_t *incremental = mem_alloc(chunk_blocks * BENCH_WORLD_SIZE * BENCH_WORLD_SIZE);
+    assert(incremental && "Out of memory!");
+    for (int i = 0; i < BENCH_WORLD_SIZE * BENCH_WORLD_SIZE; i++) {
+        const struct Chunk *chunk = world_get_chunk(world, i % BENCH_WORLD_SIZE, i / BENCH_WORLD_SIZE);
+        for (size_t b = 0; b < chunk_blocks; b++) {
+            incremental[i * chunk_blocks + b] = chunk_get_light(chunk, b % CHUNK_WIDTH, b / (CHUNK_WIDTH * CHUNK_WIDTH),
+                                                                b / CHUNK_WIDTH % CHUNK_WIDTH);
+        }
+        // Otherwise its stale light would spread back in
+        world_get_chunk(world, i % BENCH_WORLD_SIZE, i / BENCH_WORLD_SIZE)->lit = false;
+    }
+    for (int i = 0; i < BENCH_WORLD_SIZE * BENCH_WORLD_SIZE; i++) {
+        light_chunk_init(world, world_get_chunk(world, i % BENCH_WORLD_SIZE, i / BENCH_WORLD_SIZE));
+    }
+    for (int i = 0; i < BENCH_WORLD_SIZE * BENCH_WORLD_SIZE; i++) {
+        const struct Chunk *chunk = world_get_chunk(world, i % BENCH_WORLD_SIZE, i / BENCH_WORLD_SIZE);
+        for (size_t b = 0; b < chunk_blocks; b++) {
+            wrong += incremental[i * chunk_blocks + b] != chunk_get_light(chunk, b % CHUNK_WIDTH, b / (CHUNK_WIDTH * CHUNK_WIDTH),
+                                                                            b / CHUNK_WIDTH % CHUNK_WIDTH);
+        }
+    }
+    mem_free(incremental);
+    if (wrong) {
+        printf("light check: %zu blocks with the wrong light\n", wrong);
+        fflush(stdout);
+    }
+    assert(!wrong && "Incremental light doesn't match a full relight");
+
+    snprintf(name, sizeof(name), "light_check/%s", SECTION_LAYOUT_NAME);
+    bench_report("world", name, ops, 0, elapsed);
+}
+
+static void bench_meshing(struct World *world) {
+    struct Arena *arena = arena_create(1024 * 1024);
+    for (int level = 0; level < LOD_LEVELS; level++) {
+        char name[64];
+        size_t ops = 0, vertexes = 0;
+        double start = get_time(), elapsed;
+        do {
+            for (int z = 0; z < BENCH_WORLD_SIZE; z++) {
+                for (int x = 0; x < BENCH_WORLD_SIZE; x++) {
+                    const struct Chunk *chunk = world_get_chunk(world, x, z);
+                    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+                        if (!chunk->sections[sy] && chunk->uniform[sy] == BLOCK_AIR) {
+                            continue;
+                        }
+                        struct SectionMesh mesh;
+                        arena_reset(arena);
+                        lod_mesh_section(world, chunk, sy, level, arena, &mesh);
+                        vertexes += mesh.num_vertexes;
+                        ops++;
+                    }
+                }
+            }
+        } while ((elapsed = get_time() - start) < BENCH_WORLD_TIME);
+        snprintf(name, sizeof(name), "mesh_section/lod%d/%s", level, SECTION_LAYOUT_NAME);
+        bench_report("world", name, ops, vertexes * sizeof(struct Vertex), elapsed);
+    }
+    arena_destroy(arena);
+}
+
+// What padded_copy should have put at world position (x, y, z)
+static size_t padded_check_block(struct World *world, const struct PaddedBlocks *pad, int px, int py, int pz) {
+    const int32_t x = pad->x + px, y = pad->y + py, z = pad->z + pz;
+    BlockId id = BLOCK_AIR;
+    uint8_t light = LIGHT_FULL_SKY;
+    if (y < 0) {
+        id = BLOCK_STONE;
+        light = 0;
+    } else if (y < CHUNK_HEIGHT) {
+        const struct Chunk *chunk = world_get_chunk(world, world_to_chunk(x), world_to_chunk(z));
+        if (chunk) {
+            id = chunk_get_block(chunk, x & (CHUNK_WIDTH - 1), y, z & (CHUNK_WIDTH - 1));
+            light = chunk_get_light(chunk, x & (CHUNK_WIDTH - 1), y, z & (CHUNK_WIDTH - 1));
+        }
+    }
+    const struct BlockType *type = block_get(id);
+    const uint8_t flags = (type->opaque ? PADDED_OPAQUE : 0) | (type->blocks_motion ? PADDED_BLOCKS_MOTION : 0);
+    const size_t i = padded_index(pad, px, py, pz);
+    return pad->blocks[i] != id || pad->light[i] != light || pad->flags[i] != flags;
+}
+// Copies every section (or 2x2x2 block of them) of the world, then checks
+// copies that reach past every side of it, where the chunks aren't loaded,
+// block by block. Only the copies are timed.
+static void bench_padded_copy(struct World *world, int size) {
+    const int step = (size - 2) / SECTION_HEIGHT;
+    struct Arena *arena = arena_create(1024 * 1024);
+    struct PaddedBlocks pad;
+
+    char name[64];
+    size_t ops = 0;
+    double start = get_time(), elapsed;
+    do {
+        for (int sz = 0; sz < BENCH_WORLD_SIZE; sz += step) {
+            for (int sx = 0; sx < BENCH_WORLD_SIZE; sx += step) {
+                for (int sy = 0; sy < CHUNK_SECTIONS; sy += step) {
+                    arena_reset(arena);
+                    padded_copy(&pad, world, sx, sy, sz, size, arena);
+                    ops++;
+                }
+            }
+        }
+    } while ((elapsed = get_time() - start) < BENCH_WORLD_TIME);
+
+    size_t wrong = 0;
+    for (int sz = -1; sz <= BENCH_WORLD_SIZE - step + 1; sz += step) {
+        for (int sx = -1; sx <= BENCH_WORLD_SIZE - step + 1; sx += step) {
+            for (int sy = 0; sy < CHUNK_SECTIONS; sy += step) {
+                arena_reset(arena);
+                padded_copy(&pad, world, sx, sy, sz, size, arena);
+                for (int py = 0; py < size; py++) {
+                    for (int pz = 0; pz < size; pz++) {
+                        for (int px = 0; px < size; px++) {
+                            wrong += padded_check_block(world, &pad, px, py, pz);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    arena_destroy(arena);
+    if (wrong) {
+        printf("padded check: %zu blocks copied wrong at size %d\n", wrong, size);
+        fflush(stdout);
+    }
+    assert(!wrong && "Padded copy doesn't match the world");
+
+    const size_t count = (size_t)size * size * size;
+    snprintf(name, sizeof(name), "padded_copy/%d/%s", size, SECTION_LAYOUT_NAME);
+    bench_report("world", name, ops, ops * count * (sizeof(BlockId) + 2), elapsed);
+}
+
+static void stream_generate(struct World *world, struct Chunk *chunk, void *data) {
+    (void)data;
+    gen_chunk(world, chunk);
+}
+static void stream_count_mesh(struct Chunk *chunk, const struct SectionMesh meshes[CHUNK_SECTIONS], void *data) {
+    (void)chunk;
+    size_t *vertexes = data;
+    if (!meshes) {
+        return;
+    }
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        *vertexes += meshes[sy].num_vertexes;
+    }
+}
+// Flies along x loading, meshing and evicting as it goes
+static void bench_streaming(void) {
+    struct World *world = world_create();
+    size_t vertexes = 0;
+    struct Streamer *streamer = streamer_create(world, NULL, NULL, BENCH_VIEW_DISTANCE,
+                                                stream_generate, stream_count_mesh, &vertexes);
+    struct Camera cam = camera_create(glm_rad(70.0f), 0.1f, 1000.0f);
+    cam.aspect = 16.0f / 9.0f;
+    cam.pos[1] = 80.0f;
+    // Looking down +x
+    cam.yrot = -GLM_PI_2f;
+
+    char name[64];
+    size_t ops = 0;
+    double start = get_time(), last = start, elapsed;
+    do {
+        const double now = get_time();
+        cam.pos[0] += BENCH_FLY_SPEED * (float)(now - last);
+        last = now;
+        streamer_update(streamer, &cam);
+        ops++;
+    } while ((elapsed = get_time() - start) < BENCH_WORLD_TIME * 4);
+    snprintf(name, sizeof(name), "stream_update/%s", SECTION_LAYOUT_NAME);
+    bench_report("world", name, ops, vertexes * sizeof(struct Vertex), elapsed);
+    streamer_destroy(streamer);
+    world_destroy(world);
+}
+
+void bench_world(void) {
+    struct World *world = world_create();
+    for (int z = 0; z < BENCH_WORLD_SIZE; z++) {
+        for (int x = 0; x < BENCH_WORLD_SIZE; x++) {
+            gen_chunk(world, world_load_chunk(world, x, z));
+        }
+    }
+    bench_light_init(world);
+    bench_light_edits(world);
+    bench_meshing(world);
+    bench_padded_copy(world, PADDED_SECTION);
+    bench_padded_copy(world, PADDED_REGION);
+    // Last, it leaves the world edited
+    bench_light_check(world);
+    world_destroy(world);
+    bench_streaming();
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+#ifdef LINUX
+# include <unistd.h>
+#elif defined(OSX)
+# include <sys/resource.h>
+#endif
+
+#include "bench.h"
+#include "mem.h"
+
+static const struct BenchSuite suites[] = {
+    { .name = "lz", .run = bench_lz, },
+    { .name = "mem", .run = bench_mem, },
+    { .name = "world", .run = bench_world, },
+};
+
+bool bench_csv = false;
+
+size_t bench_rss_kib(void) {
+#ifdef LINUX
+    FILE *file = fopen("/proc/self/statm", "r");
+    unsigned long size, resident;
+    if (!file) {
+        return 0;
+    }
+    int read = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+    return read == 2 ? resident * (size_t)sysconf(_SC_PAGESIZE) / 1024 : 0;
+#elif defined(OSX)
+    // Only the peak is available here, in bytes
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t)usage.ru_maxrss / 1024;
+#else
+    return 0;
+#endif
+}
+
+void bench_report(const char *suite, const char *name, size_t ops, size_t bytes, double seconds) {
+    double ns_per_op = seconds * 1000000000.0 / (double)ops;
+    double mb_per_s = bytes ? (double)bytes / seconds / (1024.0 * 1024.0) : 0.0;
+    if (bench_csv) {
+        printf("%s,%s,%zu,%.2f,%.2f,%zu\n", suite, name, ops, ns_per_op, mb_per_s, bench_rss_kib());
+        return;
+    }
+    printf("%-8s %-32s %12.1f ns/op", suite, name, ns_per_op);
+    if (bytes) {
+        printf(" %10.1f MB/s", mb_per_s);
+    } else {
+        printf(" %15s", "");
+    }
+    printf(" %10zu KiB rss\n", bench_rss_kib());
+}
+
+// Usage: minec_bench [--csv] [suite...], runs every suite if none are given
+int main(int argc, char **argv) {
+    int num_selected = 0;
+    time_init();
+    for (int j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "--csv") == 0) {
+            bench_csv = true;
+        } else {
+            num_selected++;
+        }
+    }
+    if (bench_csv) {
+        printf("suite,name,ops,ns_per_op,mb_per_s,rss_kib\n");
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(suites); i++) {
+        bool selected = num_selected == 0;
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], suites[i].name) == 0) {
+                selected = true;
+            }
+        }
+        if (selected) {
+            suites[i].run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+#include "block.h"
+
+const struct BlockType block_types[BLOCK_COUNT] = {
+    [BLOCK_AIR] = { .name = "air", },
+    [BLOCK_STONE] = { .name = "stone", .opaque = true, .blocks_motion = true, .texture = 1, },
+    [BLOCK_DIRT] = { .name = "dirt", .opaque = true, .blocks_motion = true, .texture = 2, },
+    [BLOCK_GRASS] = { .name = "grass", .opaque = true, .blocks_motion = true, .texture = 3, },
+    [BLOCK_COAL_ORE] = { .name = "coal_ore", .opaque = true, .blocks_motion = true, .texture = 34, },
+    [BLOCK_IRON_ORE] = { .name = "iron_ore", .opaque = true, .blocks_motion = true, .texture = 33, },
+    [BLOCK_GOLD_ORE] = { .name = "gold_ore", .opaque = true, .blocks_motion = true, .texture = 32, },
+    [BLOCK_DIAMOND_ORE] = { .name = "diamond_ore", .opaque = true, .blocks_motion = true, .texture = 50, },
+    [BLOCK_LOG] = { .name = "log", .opaque = true, .blocks_motion = true, .texture = 20, },
+    [BLOCK_LEAVES] = { .name = "leaves", .blocks_motion = true, .light_filter = 1, .texture = 52, },
+    [BLOCK_GLASS] = { .name = "glass", .blocks_motion = true, .texture = 49, },
+    [BLOCK_WATER] = { .name = "water", .blocks_motion = true, .light_filter = 2, .texture = 205, },
+    [BLOCK_TORCH] = { .name = "torch", .light_emission = 14, .texture = 80, },
+    [BLOCK_GLOWSTONE] = { .name = "glowstone", .opaque = true, .blocks_motion = true, .light_emission = 15, .texture = 105, },
+};
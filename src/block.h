@@ -0,0 +1,45 @@
+#ifndef _BLOCK_H
+#define _BLOCK_H
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint16_t BlockId;
+enum {
+    BLOCK_AIR,
+    BLOCK_STONE,
+    BLOCK_DIRT,
+    BLOCK_GRASS,
+    BLOCK_COAL_ORE,
+    BLOCK_IRON_ORE,
+    BLOCK_GOLD_ORE,
+    BLOCK_DIAMOND_ORE,
+    BLOCK_LOG,
+    BLOCK_LEAVES,
+    BLOCK_GLASS,
+    BLOCK_WATER,
+    BLOCK_TORCH,
+    BLOCK_GLOWSTONE,
+    BLOCK_COUNT,
+};
+
+struct BlockType {
+    const char *name;
+    // Stops light completely
+    bool opaque;
+    // Stops entities and rain, fluids count
+    bool blocks_motion;
+    // Light passing through loses this much on top of the usual 1
+    uint8_t light_filter;
+    uint8_t light_emission;
+    // Tile in terrain.png, which is also its texture array layer
+    uint8_t texture;
+};
+
+extern const struct BlockType block_types[BLOCK_COUNT];
+
+// Ids nothing knows about (from a newer save) act like stone
+static inline const struct BlockType *block_get(BlockId id) {
+    return &block_types[id < BLOCK_COUNT ? id : BLOCK_STONE];
+}
+
+#endif
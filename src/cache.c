@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cache.h"
+#include "profile.h"
+#include "save.h"
+
+#define CHUNK_CACHE_INITIAL_CAP 256
+
+static size_t cache_slot_home(const void *slot, size_t mask) {
+    const struct CachedChunk *entry = *(struct CachedChunk *const *)slot;
+    return entry ? chunk_pos_hash(entry->x, entry->z) & mask : SIZE_MAX;
+}
+
+struct ChunkCache *chunk_cache_create(size_t budget) {
+    MEM_TAG_SCOPE(MEM_TAG_CACHE);
+    struct ChunkCache *cache = mem_alloc(sizeof(struct ChunkCache));
+    assert(cache && "Out of memory!");
+    *cache = (struct ChunkCache) {
+        .budget = budget,
+        .bytes = 0,
+        .slots = mem_alloc(sizeof(struct CachedChunk *) * CHUNK_CACHE_INITIAL_CAP),
+        .num_entries = 0,
+        .cap = CHUNK_CACHE_INITIAL_CAP,
+        .newest = NULL,
+        .oldest = NULL,
+        .entry_pool = pool_create(CHUNK_CACHE_INITIAL_CAP, sizeof(struct CachedChunk), true),
+        .stats = (struct ChunkCacheStats) {0},
+    };
+    assert(cache->slots && "Out of memory!");
+    memset(cache->slots, 0, sizeof(struct CachedChunk *) * cache->cap);
+    return cache;
+}
+void chunk_cache_destroy(struct ChunkCache *cache) {
+    for (struct CachedChunk *entry = cache->newest; entry; entry = entry->older) {
+        mem_free(entry->data);
+    }
+    pool_destroy(cache->entry_pool);
+    mem_free(cache->slots);
+    mem_free(cache);
+}
+void chunk_cache_print_stats(const struct ChunkCache *cache) {
+    const struct ChunkCacheStats *stats = &cache->stats;
+    const uint64_t lookups = stats->hits + stats->misses;
+    printf("cache: %zu chunks, %zu/%zu KiB, %llu stored, %llu hits, %llu misses (%.1f%% hit), %llu evicted, %.1fx compression\n",
+            cache->num_entries, cache->bytes / 1024, cache->budget / 1024,
+            (unsigned long long)stats->stores, (unsigned long long)stats->hits,
+            (unsigned long long)stats->misses, lookups ? 100.0 * stats->hits / lookups : 0.0,
+            (unsigned long long)stats->evictions,
+            stats->stored_bytes ? (double)stats->raw_bytes / stats->stored_bytes : 0.0);
+}
+
+static size_t cache_find_slot(const struct ChunkCache *cache, int32_t x, int32_t z) {
+    size_t mask = cache->cap - 1;
+    size_t i = chunk_pos_hash(x, z) & mask;
+    while (cache->slots[i] && (cache->slots[i]->x != x || cache->slots[i]->z != z)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+static void cache_grow(struct ChunkCache *cache) {
+    MEM_TAG_SCOPE(MEM_TAG_CACHE);
+    struct CachedChunk **old = cache->slots;
+    size_t old_cap = cache->cap;
+
+    cache->cap *= 2;
+    cache->slots = mem_alloc(sizeof(struct CachedChunk *) * cache->cap);
+    assert(cache->slots && "Out of memory!");
+    memset(cache->slots, 0, sizeof(struct CachedChunk *) * cache->cap);
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            cache->slots[cache_find_slot(cache, old[i]->x, old[i]->z)] = old[i];
+        }
+    }
+    mem_free(old);
+}
+static void cache_remove(struct ChunkCache *cache, struct CachedChunk *entry) {
+    size_t i = table_remove_slot(cache->slots, sizeof(*cache->slots), cache->cap,
+                                    cache_find_slot(cache, entry->x, entry->z), cache_slot_home);
+    cache->slots[i] = NULL;
+    cache->num_entries--;
+
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+    cache->bytes -= entry->size;
+    mem_free(entry->data);
+    pool_free(cache->entry_pool, entry);
+}
+
+void chunk_cache_store(struct ChunkCache *cache, struct World *world, struct Chunk *chunk) {
+    PROFILE_ZONE("chunk_cache_store");
+    MEM_TAG_SCOPE(MEM_TAG_CACHE);
+    size_t slot = cache_find_slot(cache, chunk->x, chunk->z);
+    if (cache->slots[slot]) {
+        cache_remove(cache, cache->slots[slot]);
+    }
+    if ((cache->num_entries + 1) * 10 > cache->cap * 7) {
+        cache_grow(cache);
+    }
+
+    // Uniform sections cost nothing and shared ones are only stored once
+    // while they're loaded, compressing pays off on what's left
+    chunk_compact(world, chunk);
+    size_t size;
+    struct Arena *scratch = scratch_arena();
+    struct ArenaMark scratch_mark = arena_mark(scratch);
+    const uint8_t *buf = save_encode_chunk(chunk->x, chunk->z, chunk->sections, chunk->uniform, scratch, &size);
+    struct CachedChunk *entry = pool_alloc(cache->entry_pool);
+    assert(entry && "Out of memory!");
+    *entry = (struct CachedChunk) {
+        .x = chunk->x,
+        .z = chunk->z,
+        .data = mem_alloc(size),
+        .size = size,
+        .older = cache->newest,
+        .newer = NULL,
+    };
+    assert(entry->data && "Out of memory!");
+    memcpy(entry->data, buf, size);
+    arena_rewind(scratch, scratch_mark);
+    if (cache->newest) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+    cache->slots[cache_find_slot(cache, entry->x, entry->z)] = entry;
+    cache->num_entries++;
+    cache->bytes += size;
+
+    cache->stats.stores++;
+    cache->stats.stored_bytes += size;
+    for (int i = 0; i < CHUNK_SECTIONS; i++) {
+        cache->stats.raw_bytes += chunk->sections[i] ? sizeof(chunk->sections[i]->blocks) : 0;
+    }
+    while (cache->bytes > cache->budget && cache->oldest) {
+        cache_remove(cache, cache->oldest);
+        cache->stats.evictions++;
+    }
+}
+struct Chunk *chunk_cache_take(struct ChunkCache *cache, struct World *world, int32_t x, int32_t z) {
+    struct CachedChunk *entry = cache->slots[cache_find_slot(cache, x, z)];
+    if (!entry) {
+        cache->stats.misses++;
+        return NULL;
+    }
+    PROFILE_ZONE("chunk_cache_take");
+    struct Arena *scratch = scratch_arena();
+    struct ArenaMark scratch_mark = arena_mark(scratch);
+    struct Chunk *chunk = save_decode_chunk(world, entry->data, entry->size, x, z, scratch);
+    arena_rewind(scratch, scratch_mark);
+    // Never came from outside, it can't be corrupt
+    assert(chunk);
+    cache_remove(cache, entry);
+    cache->stats.hits++;
+    return chunk;
+}
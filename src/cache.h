@@ -0,0 +1,48 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+#include "world.h"
+
+// One chunk in the chunk file format, see save_encode_chunk
+struct CachedChunk {
+    int32_t x, z;
+    uint8_t *data;
+    size_t size;
+    // Towards the least recently used end
+    struct CachedChunk *older, *newer;
+};
+struct ChunkCacheStats {
+    uint64_t stores, hits, misses, evictions;
+    // What the stored chunks took up before and after compression
+    uint64_t raw_bytes, stored_bytes;
+};
+// Compressed chunks that were unloaded but might be needed again soon,
+// loading one of these skips the disk. Once the cache goes over its budget
+// the least recently used ones are dropped. It doesn't save anything, only
+// put chunks in it that are saved or don't need to be.
+struct ChunkCache {
+    // Bytes of compressed data it can hold
+    size_t budget, bytes;
+    // Open addressing hash table by position
+    struct CachedChunk **slots;
+    size_t num_entries, cap;
+    struct CachedChunk *newest, *oldest;
+    struct Pool *entry_pool;
+    struct ChunkCacheStats stats;
+};
+
+// Will never return NULL cache
+struct ChunkCache *chunk_cache_create(size_t budget);
+void chunk_cache_destroy(struct ChunkCache *cache);
+// Compresses the chunk into the cache, it stays loaded
+void chunk_cache_store(struct ChunkCache *cache, struct World *world, struct Chunk *chunk);
+// Loads and lights the chunk if it's in the cache, it leaves the cache
+// again. NULL on a miss.
+struct Chunk *chunk_cache_take(struct ChunkCache *cache, struct World *world, int32_t x, int32_t z);
+void chunk_cache_print_stats(const struct ChunkCache *cache);
+
+#endif
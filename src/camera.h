@@ -60,6 +60,14 @@ static inline void camera_get_view(struct Camera *cam, mat4 view) {
         glm_quat_look(cam->pos, cam->rot, view);
     }
 }
+// Camera state between two simulation ticks, t goes from 0 (prev) to 1 (cur)
+static inline void camera_lerp(const struct Camera *prev, const struct Camera *cur, float t, struct Camera *out) {
+    *out = *cur;
+    glm_vec3_lerp((float *)prev->pos, (float *)cur->pos, t, out->pos);
+    glm_quat_slerp((float *)prev->rot, (float *)cur->rot, t, out->rot);
+    out->xrot = prev->xrot + (cur->xrot - prev->xrot) * t;
+    out->yrot = prev->yrot + (cur->yrot - prev->yrot) * t;
+}
 static inline void camera_get_mat(struct Camera *cam, mat4 mat) {
     mat4 proj, view;
     camera_get_proj(cam, proj);
@@ -1,5 +1,11 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
+#ifdef WIN32
+# include <direct.h>
+#else
+# include <sys/stat.h>
+#endif
 
 #include "file.h"
 
@@ -20,8 +26,63 @@ char *file_load_as_string(AllocInterface alloc, void *allocator, const char *pat
     assert(str_buf && "Out of memory!");
     if (fread(str_buf, 1, str_len, file) != str_len) {
         printf("file_load_as_string error: Couldn't read whole file.\n");
-        str_buf[0] = '\0';
+        str_len = 0;
     }
+    str_buf[str_len] = '\0';
 
+    fclose(file);
     return str_buf;
 }
+void *file_load(AllocInterface alloc, void *allocator, const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void *buf = alloc(allocator, *size ? *size : 1);
+    assert(buf && "Out of memory!");
+    if (fread(buf, 1, *size, file) != *size) {
+        printf("file_load error: Couldn't read whole file %s.\n", path);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    return buf;
+}
+bool file_write(const char *path, const void *data, size_t size) {
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        printf("file_write error: Can't open the file %s\n", tmp_path);
+        return false;
+    }
+    bool ok = fwrite(data, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        printf("file_write error: Couldn't write whole file %s.\n", tmp_path);
+        remove(tmp_path);
+        return false;
+    }
+#ifdef WIN32
+    remove(path);
+#endif
+    if (rename(tmp_path, path) != 0) {
+        printf("file_write error: Can't replace the file %s\n", path);
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+bool file_make_dir(const char *path) {
+#ifdef WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
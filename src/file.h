@@ -3,5 +3,10 @@
 #include "mem.h"
 
 char *file_load_as_string(AllocInterface alloc, void *allocator, const char *path);
+// Returns NULL if the file can't be read
+void *file_load(AllocInterface alloc, void *allocator, const char *path, size_t *size);
+// Writes to a temporary file first so a crash never leaves a half written file
+bool file_write(const char *path, const void *data, size_t size);
+bool file_make_dir(const char *path);
 
 #endif
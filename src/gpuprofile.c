@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpuprofile.h"
+
+// The gpu and cpu clocks drift apart, so line them up again every so often
+#define GPU_PROFILE_SYNC_FRAMES 120
+#define GPU_PROFILE_NO_ZONE SIZE_MAX
+
+static void gpu_profiler_sync_clocks(struct GpuProfiler *prof) {
+    GLint64 gpu_now;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+    uint64_t cpu_now = profile_ticks_to_ns(time_ticks());
+    prof->clock_offset = (int64_t)cpu_now - (int64_t)gpu_now;
+    prof->frames_since_sync = 0;
+}
+
+void gpu_profiler_init(struct GpuProfiler *prof) {
+    GLint bits = 0;
+
+    memset(prof, 0, sizeof(*prof));
+#ifndef PROFILE_ENABLED
+    // Stays unsupported so release builds never issue a query
+    return;
+#endif
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+    prof->supported = bits > 0;
+    if (!prof->supported) {
+        printf("gpu profiler error: Timestamp queries aren't supported.\n");
+        return;
+    }
+
+    glGenQueries(GPU_PROFILE_FRAMES * (GPU_PROFILE_MAX_ZONES * 2 + 1), &prof->queries[0][0]);
+    prof->track = profile_create_track("gpu");
+    gpu_profiler_sync_clocks(prof);
+}
+void gpu_profiler_destroy(struct GpuProfiler *prof) {
+    if (prof->supported) {
+        glDeleteQueries(GPU_PROFILE_FRAMES * (GPU_PROFILE_MAX_ZONES * 2 + 1), &prof->queries[0][0]);
+        prof->supported = false;
+    }
+}
+
+void gpu_zone_begin(struct GpuProfiler *prof, const char *name) {
+    assert(prof->depth < GPU_PROFILE_MAX_DEPTH);
+    if (!prof->supported) {
+        return;
+    }
+
+    struct GpuProfileFrame *frame = &prof->frames[prof->frame];
+    if (frame->num_zones == GPU_PROFILE_MAX_ZONES) {
+        prof->stack[prof->depth++] = GPU_PROFILE_NO_ZONE;
+        return;
+    }
+    size_t zone = frame->num_zones++;
+    frame->names[zone] = name;
+    glQueryCounter(prof->queries[prof->frame][zone * 2], GL_TIMESTAMP);
+    prof->stack[prof->depth++] = zone;
+}
+void gpu_zone_end(struct GpuProfiler *prof) {
+    if (!prof->supported) {
+        return;
+    }
+
+    assert(prof->depth > 0);
+    size_t zone = prof->stack[--prof->depth];
+    if (zone != GPU_PROFILE_NO_ZONE) {
+        glQueryCounter(prof->queries[prof->frame][zone * 2 + 1], GL_TIMESTAMP);
+    }
+}
+
+// Returns false if the gpu hasn't gotten to the end of the frame yet
+static bool gpu_profiler_collect(struct GpuProfiler *prof, size_t idx) {
+    struct GpuProfileFrame *frame = &prof->frames[idx];
+    GLuint *queries = prof->queries[idx];
+    GLuint available = 0;
+
+    // Timestamps finish in order, so once the frame end is in so is everything else
+    glGetQueryObjectuiv(queries[GPU_PROFILE_MAX_ZONES * 2], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return false;
+    }
+
+    uint64_t first = UINT64_MAX, last = 0;
+    for (size_t i = 0; i < frame->num_zones; i++) {
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+        profile_record_ns(prof->track, frame->names[i],
+                            (uint64_t)((int64_t)begin + prof->clock_offset),
+                            (uint64_t)((int64_t)end + prof->clock_offset));
+        first = begin < first ? begin : first;
+        last = end > last ? end : last;
+    }
+    prof->last_frame_ns = frame->num_zones ? last - first : 0;
+    frame->pending = false;
+    return true;
+}
+void gpu_profiler_end_frame(struct GpuProfiler *prof) {
+    assert(prof->depth == 0 && "Unbalanced gpu zones!");
+    if (!prof->supported) {
+        return;
+    }
+
+    glQueryCounter(prof->queries[prof->frame][GPU_PROFILE_MAX_ZONES * 2], GL_TIMESTAMP);
+    prof->frames[prof->frame].pending = true;
+
+    // Oldest frames first, stop at the first one the gpu is still working on
+    for (size_t i = 1; i <= GPU_PROFILE_FRAMES; i++) {
+        size_t idx = (prof->frame + i) % GPU_PROFILE_FRAMES;
+        if (prof->frames[idx].pending && !gpu_profiler_collect(prof, idx)) {
+            break;
+        }
+    }
+
+    // If the gpu is that far behind just lose the oldest frame instead of waiting
+    prof->frame = (prof->frame + 1) % GPU_PROFILE_FRAMES;
+    if (prof->frames[prof->frame].pending) {
+        prof->dropped_frames++;
+    }
+    prof->frames[prof->frame].pending = false;
+    prof->frames[prof->frame].num_zones = 0;
+
+    if (++prof->frames_since_sync >= GPU_PROFILE_SYNC_FRAMES) {
+        gpu_profiler_sync_clocks(prof);
+    }
+}
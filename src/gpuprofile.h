@@ -0,0 +1,55 @@
+#ifndef _GPUPROFILE_H
+#define _GPUPROFILE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <glad/glad.h>
+
+#include "profile.h"
+
+// Results are read this many frames later so the cpu never waits on the gpu
+#define GPU_PROFILE_FRAMES 4
+#define GPU_PROFILE_MAX_ZONES 64
+#define GPU_PROFILE_MAX_DEPTH 16
+
+struct GpuProfileFrame {
+    const char *names[GPU_PROFILE_MAX_ZONES];
+    size_t num_zones;
+    bool pending;
+};
+// GL_TIMESTAMP query pool. Timestamps (instead of GL_TIME_ELAPSED) let
+// zones nest, and they map straight onto the cpu profiler's timeline.
+struct GpuProfiler {
+    bool supported;
+    // Two queries per zone and one for the end of the frame
+    GLuint queries[GPU_PROFILE_FRAMES][GPU_PROFILE_MAX_ZONES * 2 + 1];
+    struct GpuProfileFrame frames[GPU_PROFILE_FRAMES];
+    size_t frame;
+    size_t stack[GPU_PROFILE_MAX_DEPTH], depth;
+
+    // Gpu time + offset = nanoseconds since profile_init
+    int64_t clock_offset;
+    uint32_t frames_since_sync;
+
+    struct ProfileBuffer *track;
+    uint64_t last_frame_ns;
+    size_t dropped_frames;
+};
+
+// Needs a current GL context
+void gpu_profiler_init(struct GpuProfiler *prof);
+void gpu_profiler_destroy(struct GpuProfiler *prof);
+void gpu_zone_begin(struct GpuProfiler *prof, const char *name);
+void gpu_zone_end(struct GpuProfiler *prof);
+// Call after the last draw of the frame, records every finished frame's zones
+void gpu_profiler_end_frame(struct GpuProfiler *prof);
+
+#ifdef PROFILE_ENABLED
+# define GPU_ZONE_BEGIN(prof, name) gpu_zone_begin(prof, name)
+# define GPU_ZONE_END(prof) gpu_zone_end(prof)
+#else
+# define GPU_ZONE_BEGIN(prof, name) (void)0
+# define GPU_ZONE_END(prof) (void)0
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+#include <assert.h>
+#include <string.h>
+
+#include "handle.h"
+#include "mem.h"
+
+#define HANDLE_NO_SLOT UINT32_MAX
+// Dense storage shrinks back down once it's this many times too big
+#define HANDLE_SHRINK_FACTOR 4
+
+static inline Handle handle_make(uint32_t index, uint32_t generation) {
+    return (Handle)generation << 32 | index;
+}
+
+struct HandleTable *handle_table_create(size_t elem_size, size_t initial_cap) {
+    assert(elem_size && initial_cap);
+    struct HandleTable *table = mem_alloc(sizeof(struct HandleTable));
+    assert(table && "Out of memory!");
+    *table = (struct HandleTable) {
+        .elem_size = elem_size,
+        .dense = mem_alloc(elem_size * initial_cap),
+        .dense_handles = mem_alloc(sizeof(Handle) * initial_cap),
+        .count = 0,
+        .cap = initial_cap,
+        .slots = mem_alloc(sizeof(struct HandleSlot) * initial_cap),
+        .num_slots = 0,
+        .slots_cap = initial_cap,
+        .free_slot = HANDLE_NO_SLOT,
+    };
+    assert(table->dense && table->dense_handles && table->slots && "Out of memory!");
+    return table;
+}
+void handle_table_destroy(struct HandleTable *table) {
+    mem_free(table->slots);
+    mem_free(table->dense_handles);
+    mem_free(table->dense);
+    mem_free(table);
+}
+
+static void handle_table_resize(struct HandleTable *table, size_t cap) {
+    table->cap = cap;
+    table->dense = mem_realloc(table->dense, table->elem_size * cap);
+    table->dense_handles = mem_realloc(table->dense_handles, sizeof(Handle) * cap);
+    assert(table->dense && table->dense_handles && "Out of memory!");
+}
+Handle handle_table_alloc(struct HandleTable *table, void **out) {
+    uint32_t index = table->free_slot;
+    if (index != HANDLE_NO_SLOT) {
+        table->free_slot = table->slots[index].index;
+    } else {
+        if (table->num_slots == table->slots_cap) {
+            table->slots_cap *= 2;
+            table->slots = mem_realloc(table->slots, sizeof(struct HandleSlot) * table->slots_cap);
+            assert(table->slots && "Out of memory!");
+        }
+        assert(table->num_slots < HANDLE_NO_SLOT && "Too many handles!");
+        index = table->num_slots++;
+        table->slots[index].generation = 1;
+    }
+    if (table->count == table->cap) {
+        handle_table_resize(table, table->cap * 2);
+    }
+
+    struct HandleSlot *slot = &table->slots[index];
+    Handle handle = handle_make(index, slot->generation);
+    slot->index = table->count++;
+    table->dense_handles[slot->index] = handle;
+    void *obj = table->dense + slot->index * table->elem_size;
+    memset(obj, 0, table->elem_size);
+    if (out) {
+        *out = obj;
+    }
+    return handle;
+}
+bool handle_table_free(struct HandleTable *table, Handle handle) {
+    if (!handle_table_valid(table, handle)) {
+        return false;
+    }
+
+    // Move the last object into the hole
+    struct HandleSlot *slot = &table->slots[handle_index(handle)];
+    size_t last = --table->count;
+    if (slot->index != last) {
+        memcpy(table->dense + slot->index * table->elem_size,
+                table->dense + last * table->elem_size, table->elem_size);
+        Handle moved = table->dense_handles[last];
+        table->dense_handles[slot->index] = moved;
+        table->slots[handle_index(moved)].index = slot->index;
+    }
+
+    // Generation 0 is never handed out so HANDLE_NULL stays invalid
+    if (++slot->generation == 0) {
+        slot->generation = 1;
+    }
+    slot->index = table->free_slot;
+    table->free_slot = handle_index(handle);
+
+    if (table->cap > 16 && table->count * HANDLE_SHRINK_FACTOR < table->cap) {
+        handle_table_resize(table, table->cap / 2);
+    }
+    return true;
+}
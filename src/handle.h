@@ -0,0 +1,67 @@
+#ifndef _HANDLE_H
+#define _HANDLE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Slot index in the low 32 bits, generation in the high 32. Generations
+// start at 1 so HANDLE_NULL never refers to anything.
+typedef uint64_t Handle;
+#define HANDLE_NULL 0
+
+static inline uint32_t handle_index(Handle handle) {
+    return (uint32_t)handle;
+}
+static inline uint32_t handle_generation(Handle handle) {
+    return (uint32_t)(handle >> 32);
+}
+
+struct HandleSlot {
+    // Where the object is in dense while it's alive, the next free slot after
+    uint32_t index;
+    // Bumped every time the slot is freed, old handles stop matching
+    uint32_t generation;
+};
+// Objects are packed at the front of one array, freeing one moves the
+// last object into its place. Handles go through the slots, so they stay
+// valid when objects move but pointers only last until the next alloc or free.
+struct HandleTable {
+    size_t elem_size;
+    uint8_t *dense;
+    // Handle of every object in dense
+    Handle *dense_handles;
+    size_t count, cap;
+
+    struct HandleSlot *slots;
+    size_t num_slots, slots_cap;
+    uint32_t free_slot;
+};
+
+// Will never return NULL table
+struct HandleTable *handle_table_create(size_t elem_size, size_t initial_cap);
+void handle_table_destroy(struct HandleTable *table);
+// The new object is zeroed, out (if not NULL) gets a pointer to it
+Handle handle_table_alloc(struct HandleTable *table, void **out);
+// Returns false if the handle is stale
+bool handle_table_free(struct HandleTable *table, Handle handle);
+
+static inline bool handle_table_valid(const struct HandleTable *table, Handle handle) {
+    uint32_t index = handle_index(handle);
+    return index < table->num_slots && table->slots[index].generation == handle_generation(handle);
+}
+// NULL if the object was freed
+static inline void *handle_table_get(const struct HandleTable *table, Handle handle) {
+    if (!handle_table_valid(table, handle)) {
+        return NULL;
+    }
+    return table->dense + table->slots[handle_index(handle)].index * table->elem_size;
+}
+// Objects are contiguous, iterate i from 0 to table->count
+static inline void *handle_table_at(const struct HandleTable *table, size_t i) {
+    return table->dense + i * table->elem_size;
+}
+static inline Handle handle_table_handle_at(const struct HandleTable *table, size_t i) {
+    return table->dense_handles[i];
+}
+
+#endif
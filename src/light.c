@@ -0,0 +1,398 @@
+#include <assert.h>
+#include <string.h>
+
+#include "light.h"
+#include "profile.h"
+#include "world.h"
+
+#define LIGHT_QUEUE_INITIAL 1024
+
+static const int8_t light_dirs[6][3] = {
+    { 1, 0, 0 }, { -1, 0, 0 },
+    { 0, 1, 0 }, { 0, -1, 0 },
+    { 0, 0, 1 }, { 0, 0, -1 },
+};
+#define LIGHT_DIR_DOWN 3
+
+void light_engine_init(struct LightEngine *engine) {
+    memset(engine, 0, sizeof(*engine));
+}
+void light_engine_destroy(struct LightEngine *engine) {
+    for (int ch = 0; ch < LIGHT_CHANNELS; ch++) {
+        if (engine->add[ch].nodes) mem_free(engine->add[ch].nodes);
+        if (engine->remove[ch].nodes) mem_free(engine->remove[ch].nodes);
+    }
+}
+
+static void light_queue_push(struct LightQueue *queue, int32_t x, int32_t y, int32_t z, uint8_t level) {
+    if (queue->tail == queue->cap) {
+        queue->cap = queue->cap ? queue->cap * 2 : LIGHT_QUEUE_INITIAL;
+        queue->nodes = mem_realloc(queue->nodes, sizeof(struct LightNode) * queue->cap);
+        assert(queue->nodes && "Out of memory!");
+    }
+    queue->nodes[queue->tail++] = (struct LightNode) {
+        .x = x,
+        .z = z,
+        .y = (int16_t)y,
+        .level = level,
+    };
+}
+static bool light_queue_pop(struct LightQueue *queue, struct LightNode *node) {
+    if (queue->head == queue->tail) {
+        queue->head = queue->tail = 0;
+        return false;
+    }
+    *node = queue->nodes[queue->head++];
+    return true;
+}
+
+// Chunks light can be in, ones that haven't been lit yet only have
+// placeholder light and are left alone
+static inline struct Chunk *light_get_chunk(struct World *world, int32_t cx, int32_t cz) {
+    struct Chunk *chunk = world_get_chunk(world, cx, cz);
+    return chunk && chunk->lit ? chunk : NULL;
+}
+// Neighbouring blocks are nearly always in the same chunk, so the last
+// lookup is remembered (including chunks that aren't loaded)
+struct LightCursor {
+    struct World *world;
+    struct Chunk *chunk;
+    int32_t cx, cz;
+    bool valid;
+};
+static inline struct Chunk *light_cursor_chunk(struct LightCursor *cursor, int32_t x, int32_t z) {
+    int32_t cx = world_to_chunk(x), cz = world_to_chunk(z);
+    if (!cursor->valid || cx != cursor->cx || cz != cursor->cz) {
+        cursor->chunk = light_get_chunk(cursor->world, cx, cz);
+        cursor->cx = cx;
+        cursor->cz = cz;
+        cursor->valid = true;
+    }
+    return cursor->chunk;
+}
+
+static inline uint8_t light_get(const struct Chunk *chunk, int x, int y, int z, enum LightChannel ch) {
+    uint8_t packed = chunk_get_light(chunk, x, y, z);
+    return ch == LIGHT_SKY ? light_sky(packed) : light_block(packed);
+}
+static void light_set(struct World *world, struct Chunk *chunk, int x, int y, int z,
+                        enum LightChannel ch, uint8_t level) {
+    int sy = y / SECTION_HEIGHT;
+    struct SectionLight *light = chunk->light[sy];
+    uint8_t fill = chunk->light_fill[sy];
+    uint8_t *packed = light ? &light->levels[section_block_index(x, y % SECTION_HEIGHT, z)] : &fill;
+    uint8_t value = ch == LIGHT_SKY ? LIGHT_PACK(level, light_block(*packed))
+                                    : LIGHT_PACK(light_sky(*packed), level);
+    if (value == *packed) {
+        return;
+    }
+    if (!light) {
+        light = pool_alloc(world->light_pool);
+        assert(light && "Out of memory!");
+        memset(light->levels, fill, sizeof(light->levels));
+        chunk->light[sy] = light;
+        packed = &light->levels[section_block_index(x, y % SECTION_HEIGHT, z)];
+    }
+    *packed = value;
+    // Meshes bake light in, including the light of the blocks around them
+    chunk_clear_meshed(world, chunk, x, z);
+}
+
+// What a block at level gives its neighbour in direction dir, 0 if nothing gets through
+static inline uint8_t light_spread(enum LightChannel ch, int dir, uint8_t level, const struct BlockType *to) {
+    if (to->opaque) {
+        return 0;
+    }
+    // Sky light goes straight down through clear blocks without fading
+    if (ch == LIGHT_SKY && dir == LIGHT_DIR_DOWN && level == LIGHT_MAX && !to->light_filter) {
+        return LIGHT_MAX;
+    }
+    int spread = level - 1 - to->light_filter;
+    return spread > 0 ? spread : 0;
+}
+
+// Clears out everything lit by the removed nodes. Neighbours that are at
+// least as bright must have another source, they go on the add queue to
+// fill the hole back in.
+static void light_run_remove(struct World *world, enum LightChannel ch) {
+    struct LightQueue *remove = &world->light.remove[ch], *add = &world->light.add[ch];
+    struct LightCursor cursor = { .world = world, };
+    struct LightNode node;
+    while (light_queue_pop(remove, &node)) {
+        for (int d = 0; d < 6; d++) {
+            int32_t nx = node.x + light_dirs[d][0], ny = node.y + light_dirs[d][1], nz = node.z + light_dirs[d][2];
+            if (ny < 0 || ny >= CHUNK_HEIGHT) {
+                continue;
+            }
+            struct Chunk *chunk = light_cursor_chunk(&cursor, nx, nz);
+            if (!chunk) {
+                continue;
+            }
+            int lx = nx & (CHUNK_WIDTH - 1), lz = nz & (CHUNK_WIDTH - 1);
+            uint8_t level = light_get(chunk, lx, ny, lz, ch);
+            if (!level) {
+                continue;
+            }
+
+            bool lit_by_us = level < node.level
+                || (ch == LIGHT_SKY && d == LIGHT_DIR_DOWN && node.level == LIGHT_MAX && level == LIGHT_MAX);
+            if (lit_by_us) {
+                light_set(world, chunk, lx, ny, lz, ch, 0);
+                light_queue_push(remove, nx, ny, nz, level);
+                // Light sources keep their own light
+                uint8_t emission = ch == LIGHT_BLOCK ? block_get(chunk_get_block(chunk, lx, ny, lz))->light_emission : 0;
+                if (emission) {
+                    light_set(world, chunk, lx, ny, lz, ch, emission);
+                    light_queue_push(add, nx, ny, nz, emission);
+                }
+            } else {
+                light_queue_push(add, nx, ny, nz, level);
+            }
+            world->light.nodes_visited++;
+        }
+    }
+}
+static void light_run_add(struct World *world, enum LightChannel ch) {
+    struct LightQueue *add = &world->light.add[ch];
+    struct LightCursor cursor = { .world = world, };
+    struct LightNode node;
+    while (light_queue_pop(add, &node)) {
+        struct Chunk *chunk = light_cursor_chunk(&cursor, node.x, node.z);
+        if (!chunk) {
+            continue;
+        }
+        // Always spread what's there now, a removal may have come through since
+        uint8_t level = light_get(chunk, node.x & (CHUNK_WIDTH - 1), node.y, node.z & (CHUNK_WIDTH - 1), ch);
+        if (level <= 1) {
+            continue;
+        }
+        for (int d = 0; d < 6; d++) {
+            int32_t nx = node.x + light_dirs[d][0], ny = node.y + light_dirs[d][1], nz = node.z + light_dirs[d][2];
+            if (ny < 0 || ny >= CHUNK_HEIGHT) {
+                continue;
+            }
+            struct Chunk *next = light_cursor_chunk(&cursor, nx, nz);
+            if (!next) {
+                continue;
+            }
+            int lx = nx & (CHUNK_WIDTH - 1), lz = nz & (CHUNK_WIDTH - 1);
+            uint8_t spread = light_spread(ch, d, level, block_get(chunk_get_block(next, lx, ny, lz)));
+            if (spread > light_get(next, lx, ny, lz, ch)) {
+                light_set(world, next, lx, ny, lz, ch, spread);
+                light_queue_push(add, nx, ny, nz, spread);
+                world->light.nodes_visited++;
+            }
+        }
+    }
+}
+void light_update(struct World *world) {
+    PROFILE_ZONE("light_update");
+    for (int ch = 0; ch < LIGHT_CHANNELS; ch++) {
+        light_run_remove(world, ch);
+        light_run_add(world, ch);
+    }
+}
+
+void light_block_changed(struct World *world, int32_t x, int32_t y, int32_t z, BlockId old_id) {
+    struct Chunk *chunk = light_get_chunk(world, world_to_chunk(x), world_to_chunk(z));
+    if (!chunk || y < 0 || y >= CHUNK_HEIGHT) {
+        return;
+    }
+    int lx = x & (CHUNK_WIDTH - 1), lz = z & (CHUNK_WIDTH - 1);
+    const struct BlockType *old = block_get(old_id), *type = block_get(chunk_get_block(chunk, lx, y, lz));
+    if (old->opaque == type->opaque && old->light_filter == type->light_filter
+        && old->light_emission == type->light_emission) {
+        return;
+    }
+
+    for (int ch = 0; ch < LIGHT_CHANNELS; ch++) {
+        // Take out whatever light the block had, the neighbours refill it
+        // below if it lets light through
+        uint8_t level = light_get(chunk, lx, y, lz, ch);
+        if (level) {
+            light_set(world, chunk, lx, y, lz, ch, 0);
+            light_queue_push(&world->light.remove[ch], x, y, z, level);
+        }
+        if (ch == LIGHT_BLOCK && type->light_emission) {
+            light_set(world, chunk, lx, y, lz, ch, type->light_emission);
+            light_queue_push(&world->light.add[ch], x, y, z, type->light_emission);
+        }
+        if (type->opaque) {
+            continue;
+        }
+        if (ch == LIGHT_SKY && y == CHUNK_HEIGHT - 1 && !type->light_filter) {
+            light_set(world, chunk, lx, y, lz, ch, LIGHT_MAX);
+            light_queue_push(&world->light.add[ch], x, y, z, LIGHT_MAX);
+        }
+        for (int d = 0; d < 6; d++) {
+            int32_t nx = x + light_dirs[d][0], ny = y + light_dirs[d][1], nz = z + light_dirs[d][2];
+            if (ny < 0 || ny >= CHUNK_HEIGHT) {
+                continue;
+            }
+            struct Chunk *next = light_get_chunk(world, world_to_chunk(nx), world_to_chunk(nz));
+            uint8_t near = next ? light_get(next, nx & (CHUNK_WIDTH - 1), ny, nz & (CHUNK_WIDTH - 1), ch) : 0;
+            if (near) {
+                light_queue_push(&world->light.add[ch], nx, ny, nz, near);
+            }
+        }
+    }
+}
+
+void light_chunk_init(struct World *world, struct Chunk *chunk) {
+    PROFILE_ZONE("light_chunk_init");
+    chunk->lit = true;
+    // Lowest y every column still gets full sky at, the sky stops at the
+    // first block that isn't clear
+    uint16_t sky_y[CHUNK_WIDTH][CHUNK_WIDTH];
+    int top = 0;
+    for (int z = 0; z < CHUNK_WIDTH; z++) {
+        for (int x = 0; x < CHUNK_WIDTH; x++) {
+            int y = chunk_get_height(chunk, HEIGHTMAP_SKY, x, z);
+            sky_y[x][z] = y;
+            if (y > top) {
+                top = y;
+            }
+        }
+    }
+
+    // Sections above every column are all sky, the rest start dark
+    top = (top + SECTION_HEIGHT - 1) / SECTION_HEIGHT * SECTION_HEIGHT;
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        if (chunk->light[sy]) {
+            pool_free(world->light_pool, chunk->light[sy]);
+            chunk->light[sy] = NULL;
+        }
+        chunk->light_fill[sy] = sy * SECTION_HEIGHT >= top ? LIGHT_FULL_SKY : 0;
+    }
+
+    struct LightQueue *sky = &world->light.add[LIGHT_SKY], *block = &world->light.add[LIGHT_BLOCK];
+    const int32_t bx = chunk->x * CHUNK_WIDTH, bz = chunk->z * CHUNK_WIDTH;
+    for (int z = 0; z < CHUNK_WIDTH; z++) {
+        for (int x = 0; x < CHUNK_WIDTH; x++) {
+            int y = sky_y[x][z];
+            for (int ly = y; ly < top; ly++) {
+                light_set(world, chunk, x, ly, z, LIGHT_SKY, LIGHT_MAX);
+            }
+            if (y == CHUNK_HEIGHT) {
+                continue;
+            }
+            // Only the part of the column a neighbour is darker next to can
+            // spread sideways, the rest just lights straight down. Other
+            // chunks get sorted out along with the border below.
+            int spread_to = y;
+            for (int d = 0; d < 6; d++) {
+                int nx = x + light_dirs[d][0], nz = z + light_dirs[d][2];
+                if (light_dirs[d][1] || nx < 0 || nz < 0 || nx >= CHUNK_WIDTH || nz >= CHUNK_WIDTH) {
+                    continue;
+                }
+                int near = sky_y[nx][nz];
+                if (near > spread_to) {
+                    spread_to = near;
+                }
+            }
+            for (int ly = y; ly <= spread_to && ly < CHUNK_HEIGHT; ly++) {
+                light_queue_push(sky, bx + x, ly, bz + z, LIGHT_MAX);
+            }
+        }
+    }
+
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        const struct Section *section = chunk->sections[sy];
+        if (!section && !block_get(chunk->uniform[sy])->light_emission) {
+            continue;
+        }
+        for (int i = 0; i < SECTION_BLOCKS; i++) {
+            uint8_t emission = block_get(section ? section->blocks[i] : chunk->uniform[sy])->light_emission;
+            if (emission) {
+                int x, y, z;
+                section_block_pos(i, &x, &y, &z);
+                y += sy * SECTION_HEIGHT;
+                light_set(world, chunk, x, y, z, LIGHT_BLOCK, emission);
+                light_queue_push(block, bx + x, y, bz + z, emission);
+            }
+        }
+    }
+
+    // Along the border with loaded neighbours, whichever side is brighter
+    // spreads into the other
+    for (int d = 0; d < 6; d++) {
+        if (light_dirs[d][1]) {
+            continue;
+        }
+        struct Chunk *next = light_get_chunk(world, chunk->x + light_dirs[d][0], chunk->z + light_dirs[d][2]);
+        if (!next) {
+            continue;
+        }
+        for (int i = 0; i < CHUNK_WIDTH; i++) {
+            // Our edge column and theirs right next to it
+            int x = light_dirs[d][0] ? (light_dirs[d][0] > 0 ? CHUNK_WIDTH - 1 : 0) : i;
+            int z = light_dirs[d][2] ? (light_dirs[d][2] > 0 ? CHUNK_WIDTH - 1 : 0) : i;
+            int nx = light_dirs[d][0] ? CHUNK_WIDTH - 1 - x : x, nz = light_dirs[d][2] ? CHUNK_WIDTH - 1 - z : z;
+            for (int y = 0; y < CHUNK_HEIGHT; y++) {
+                uint8_t ours = chunk_get_light(chunk, x, y, z), theirs = chunk_get_light(next, nx, y, nz);
+                for (int ch = 0; ch < LIGHT_CHANNELS; ch++) {
+                    uint8_t a = ch == LIGHT_SKY ? light_sky(ours) : light_block(ours);
+                    uint8_t b = ch == LIGHT_SKY ? light_sky(theirs) : light_block(theirs);
+                    if (a > b + 1) {
+                        light_queue_push(&world->light.add[ch], bx + x, y, bz + z, a);
+                    } else if (b > a + 1) {
+                        light_queue_push(&world->light.add[ch], next->x * CHUNK_WIDTH + nx, y,
+                                            next->z * CHUNK_WIDTH + nz, b);
+                    }
+                }
+            }
+        }
+    }
+
+    light_update(world);
+}
+
+size_t light_check_chunk(struct World *world, const struct Chunk *chunk) {
+    struct LightCursor cursor = { .world = world, };
+    const int32_t bx = chunk->x * CHUNK_WIDTH, bz = chunk->z * CHUNK_WIDTH;
+    size_t wrong = 0;
+    for (int y = 0; y < CHUNK_HEIGHT; y++) {
+        for (int z = 0; z < CHUNK_WIDTH; z++) {
+            for (int x = 0; x < CHUNK_WIDTH; x++) {
+                const struct BlockType *type = block_get(chunk_get_block(chunk, x, y, z));
+                // Above the world is full sky
+                uint8_t want[LIGHT_CHANNELS] = {
+                    [LIGHT_SKY] = y == CHUNK_HEIGHT - 1 ? light_spread(LIGHT_SKY, LIGHT_DIR_DOWN, LIGHT_MAX, type) : 0,
+                    [LIGHT_BLOCK] = type->light_emission,
+                };
+                // Whatever each neighbour sends this way
+                for (int d = 0; d < 6; d++) {
+                    int32_t nx = bx + x - light_dirs[d][0], ny = y - light_dirs[d][1], nz = bz + z - light_dirs[d][2];
+                    if (ny < 0 || ny >= CHUNK_HEIGHT) {
+                        continue;
+                    }
+                    const struct Chunk *from = light_cursor_chunk(&cursor, nx, nz);
+                    if (!from) {
+                        continue;
+                    }
+                    for (int ch = 0; ch < LIGHT_CHANNELS; ch++) {
+                        uint8_t spread = light_spread(ch, d, light_get(from, nx & (CHUNK_WIDTH - 1), ny, nz & (CHUNK_WIDTH - 1), ch), type);
+                        want[ch] = spread > want[ch] ? spread : want[ch];
+                    }
+                }
+                if (chunk_get_light(chunk, x, y, z) != LIGHT_PACK(want[LIGHT_SKY], want[LIGHT_BLOCK])) {
+                    wrong++;
+                }
+            }
+        }
+    }
+    return wrong;
+}
+
+uint8_t world_get_light(struct World *world, int32_t x, int32_t y, int32_t z) {
+    if (y >= CHUNK_HEIGHT) {
+        return LIGHT_FULL_SKY;
+    } else if (y < 0) {
+        return 0;
+    }
+    struct Chunk *chunk = world_get_chunk(world, world_to_chunk(x), world_to_chunk(z));
+    if (!chunk) {
+        return 0;
+    }
+    return chunk_get_light(chunk, x & (CHUNK_WIDTH - 1), y, z & (CHUNK_WIDTH - 1));
+}
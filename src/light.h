@@ -0,0 +1,69 @@
+#ifndef _LIGHT_H
+#define _LIGHT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIGHT_MAX 15
+// Sky light in the high nibble, block light in the low one
+#define LIGHT_PACK(sky, block) (uint8_t)((sky) << 4 | (block))
+#define LIGHT_FULL_SKY LIGHT_PACK(LIGHT_MAX, 0)
+
+struct World;
+struct Chunk;
+
+// Same indexing as Section blocks
+struct SectionLight {
+    uint8_t levels[16 * 16 * 16];
+};
+
+enum LightChannel {
+    LIGHT_SKY,
+    LIGHT_BLOCK,
+    LIGHT_CHANNELS,
+};
+
+struct LightNode {
+    int32_t x, z;
+    int16_t y;
+    uint8_t level;
+};
+// FIFO, resets to the start whenever it runs empty
+struct LightQueue {
+    struct LightNode *nodes;
+    size_t head, tail, cap;
+};
+// Changes are queued by chunk_set_block and only spread by light_update, so
+// a burst of edits costs one flood fill instead of one each
+struct LightEngine {
+    struct LightQueue add[LIGHT_CHANNELS], remove[LIGHT_CHANNELS];
+    // Blocks set to a new level over the lifetime of the world
+    uint64_t nodes_visited;
+};
+
+static inline uint8_t light_sky(uint8_t packed) {
+    return packed >> 4;
+}
+static inline uint8_t light_block(uint8_t packed) {
+    return packed & 0xF;
+}
+
+void light_engine_init(struct LightEngine *engine);
+void light_engine_destroy(struct LightEngine *engine);
+
+// Lights a chunk that just got its blocks and heightmaps: sky light down every column,
+// every light source in it and whatever shines in from loaded neighbours
+void light_chunk_init(struct World *world, struct Chunk *chunk);
+// Queues the relight for a block that changed, call it after the block is set
+void light_block_changed(struct World *world, int32_t x, int32_t y, int32_t z, uint16_t old_id);
+// Spreads and removes light for everything queued since the last call
+void light_update(struct World *world);
+// Blocks in the chunk whose light isn't exactly what their sources and
+// neighbours give them, 0 for every chunk once light_update has run.
+// Goes over every block, for checks only.
+size_t light_check_chunk(struct World *world, const struct Chunk *chunk);
+// Packed light at a world position, full sky above the world and nothing
+// in chunks that aren't loaded. Can be stale until light_update runs.
+uint8_t world_get_light(struct World *world, int32_t x, int32_t y, int32_t z);
+
+#endif
@@ -0,0 +1,246 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "lod.h"
+#include "profile.h"
+
+// Distinct blocks counted in a cell's top layer, any more are ignored
+#define LOD_TOP_KINDS 8
+
+struct LodCell {
+    // BLOCK_AIR if less than half of it is filled
+    BlockId id;
+    // Every block in it is opaque, all of its smaller cells are filled too
+    bool solid;
+    // Brightest sky and block light of the blocks light gets into
+    uint8_t light;
+};
+struct LodFace {
+    int8_t dir[3];
+    // Counter clockwise seen from the outside, same as the full detail faces
+    uint8_t pos[4][3];
+    uint8_t uv[4][2];
+};
+static const struct LodFace lod_faces[6] = {
+    { {  1,  0,  0 }, { { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 }, { 1, 0, 1 } }, { { 0, 1 }, { 0, 0 }, { 1, 0 }, { 1, 1 } } },
+    { { -1,  0,  0 }, { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 } }, { { 0, 1 }, { 1, 1 }, { 1, 0 }, { 0, 0 } } },
+    { {  0,  1,  0 }, { { 0, 1, 0 }, { 0, 1, 1 }, { 1, 1, 1 }, { 1, 1, 0 } }, { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 0 } } },
+    { {  0, -1,  0 }, { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 } }, { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } } },
+    { {  0,  0,  1 }, { { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } }, { { 0, 1 }, { 1, 1 }, { 1, 0 }, { 0, 0 } } },
+    { {  0,  0, -1 }, { { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } }, { { 0, 1 }, { 0, 0 }, { 1, 0 }, { 1, 1 } } },
+};
+
+static inline int32_t lod_region(int32_t v) {
+    // Rounds down for negative chunks too
+    return (v >= 0 ? v : v - (LOD_REGION_CHUNKS - 1)) / LOD_REGION_CHUNKS;
+}
+int lod_pick(float cam_x, float cam_z, int32_t x, int32_t z) {
+    const float region = LOD_REGION_CHUNKS * CHUNK_WIDTH;
+    const float cx = (float)lod_region(x) * region + region * 0.5f;
+    const float cz = (float)lod_region(z) * region + region * 0.5f;
+    const float distance = hypotf(cam_x - cx, cam_z - cz);
+    int level = 0;
+    for (float limit = LOD_FULL_DETAIL_DISTANCE; distance >= limit && level < LOD_LEVELS - 1; limit *= 2.0f) {
+        level++;
+    }
+    return level;
+}
+
+// x and z are relative to the middle chunk of near, at most a chunk outside it.
+// Same rules as padded copies for what isn't there.
+static inline void lod_sample(const struct Chunk *near[3][3], int x, int y, int z, BlockId *id, uint8_t *light) {
+    if (y < 0) {
+        *id = BLOCK_STONE;
+        *light = 0;
+        return;
+    }
+    const struct Chunk *chunk = near[(z + CHUNK_WIDTH) / CHUNK_WIDTH][(x + CHUNK_WIDTH) / CHUNK_WIDTH];
+    if (y >= CHUNK_HEIGHT || !chunk) {
+        *id = BLOCK_AIR;
+        *light = LIGHT_FULL_SKY;
+        return;
+    }
+    x &= CHUNK_WIDTH - 1;
+    z &= CHUNK_WIDTH - 1;
+    *id = chunk_get_block(chunk, x, y, z);
+    *light = chunk_get_light(chunk, x, y, z);
+}
+static struct LodCell lod_build_cell(const struct Chunk *near[3][3], int x0, int y0, int z0, int size) {
+    BlockId kinds[LOD_TOP_KINDS];
+    int counts[LOD_TOP_KINDS], num_kinds = 0, filled = 0;
+    uint8_t sky = 0, block = 0;
+    bool solid = true;
+
+    // Top down, so the first layer with anything in it picks the block
+    for (int y = size - 1; y >= 0; y--) {
+        const bool top = num_kinds == 0;
+        for (int z = 0; z < size; z++) {
+            for (int x = 0; x < size; x++) {
+                BlockId id;
+                uint8_t light;
+                lod_sample(near, x0 + x, y0 + y, z0 + z, &id, &light);
+                if (!block_get(id)->opaque) {
+                    solid = false;
+                    sky = light_sky(light) > sky ? light_sky(light) : sky;
+                    block = light_block(light) > block ? light_block(light) : block;
+                }
+                if (id == BLOCK_AIR) {
+                    continue;
+                }
+                filled++;
+                if (!top) {
+                    continue;
+                }
+                int k = 0;
+                while (k < num_kinds && kinds[k] != id) {
+                    k++;
+                }
+                if (k == num_kinds && num_kinds < LOD_TOP_KINDS) {
+                    kinds[num_kinds] = id;
+                    counts[num_kinds++] = 0;
+                }
+                if (k < num_kinds) {
+                    counts[k]++;
+                }
+            }
+        }
+    }
+
+    struct LodCell cell = (struct LodCell) {
+        .id = BLOCK_AIR,
+        .solid = solid,
+        .light = LIGHT_PACK(sky, block),
+    };
+    if (filled * 2 >= size * size * size) {
+        int best = 0;
+        for (int k = 1; k < num_kinds; k++) {
+            best = counts[k] > counts[best] ? k : best;
+        }
+        cell.id = kinds[best];
+    }
+    return cell;
+}
+
+static void lod_emit_face(const struct LodFace *face, int x, int y, int z, int size,
+                            uint8_t light, uint8_t layer, struct SectionMesh *mesh) {
+    struct Vertex *verts = &mesh->vertexes[mesh->num_vertexes];
+    for (int c = 0; c < 4; c++) {
+        verts[c] = (struct Vertex) {
+            .pos = {
+                (float)(x + face->pos[c][0] * size),
+                (float)(y + face->pos[c][1] * size),
+                (float)(z + face->pos[c][2] * size),
+            },
+            // Repeats the texture across the cell so blocks keep their size
+            .uv = { (float)(face->uv[c][0] * size), (float)(face->uv[c][1] * size), },
+            // The shader wants the sum of 4 corners, and there's nothing to occlude
+            .light = { light_sky(light) * 4, light_block(light) * 4, 3, },
+            .layer = layer,
+        };
+    }
+    static const uint8_t order[6] = { 0, 1, 2, 0, 2, 3 };
+    const VertexIdx base = (VertexIdx)mesh->num_vertexes;
+    for (int i = 0; i < 6; i++) {
+        mesh->indexes[mesh->num_indexes++] = base + order[i];
+    }
+    mesh->num_vertexes += 4;
+}
+
+void lod_mesh_section(struct World *world, const struct Chunk *chunk, int sy, int level,
+                        struct Arena *arena, struct SectionMesh *mesh) {
+    assert(level >= 0 && level < LOD_LEVELS);
+    if (level == 0) {
+        mesh_section(world, chunk, sy, arena, mesh);
+        return;
+    }
+    PROFILE_ZONE("lod_mesh_section");
+    *mesh = (struct SectionMesh) {
+        .vertexes = NULL,
+        .indexes = NULL,
+        .num_vertexes = 0,
+        .num_indexes = 0,
+    };
+    if (!chunk->sections[sy] && chunk->uniform[sy] == BLOCK_AIR) {
+        return;
+    }
+
+    const struct Chunk *near[3][3];
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            near[dz + 1][dx + 1] = dx || dz ? world_get_chunk(world, chunk->x + dx, chunk->z + dz) : chunk;
+        }
+    }
+
+    // Cells of the section with a border of cells from around it
+    const int size = lod_cell_size(level), n = SECTION_HEIGHT / size, stride = n + 2;
+    const int y0 = sy * SECTION_HEIGHT;
+    struct LodCell *cells = arena_alloc(arena, sizeof(struct LodCell) * stride * stride * stride);
+    uint8_t *visible = arena_alloc(arena, n * n * n);
+    assert(cells && visible && "Out of memory!");
+    for (int y = -1; y <= n; y++) {
+        for (int z = -1; z <= n; z++) {
+            for (int x = -1; x <= n; x++) {
+                // Only faces look at the border, so edges and corners are never used
+                if ((x < 0 || x == n) + (y < 0 || y == n) + (z < 0 || z == n) > 1) {
+                    continue;
+                }
+                cells[(x + 1) + (z + 1) * stride + (y + 1) * stride * stride]
+                    = lod_build_cell(near, x * size, y0 + y * size, z * size, size);
+            }
+        }
+    }
+
+    size_t faces = 0;
+    for (int i = 0; i < n * n * n; i++) {
+        const int x = i % n, z = i / n % n, y = i / (n * n);
+        const struct LodCell *cell = &cells[(x + 1) + (z + 1) * stride + (y + 1) * stride * stride];
+        visible[i] = 0;
+        if (cell->id == BLOCK_AIR) {
+            continue;
+        }
+        for (int f = 0; f < 6; f++) {
+            const int8_t *dir = lod_faces[f].dir;
+            const int nx = x + dir[0], ny = y + dir[1], nz = z + dir[2];
+            const struct LodCell *next = &cells[(nx + 1) + (nz + 1) * stride + (ny + 1) * stride * stride];
+            bool show = !block_get(next->id)->opaque && next->id != cell->id;
+            // Skirt: the chunk next door might be at another level with a
+            // hole here, only a neighbour solid all the way through can't be
+            if (!show && !next->solid && (nx < 0 || nx >= n || nz < 0 || nz >= n)) {
+                show = true;
+            }
+            if (show) {
+                visible[i] |= 1 << f;
+                faces++;
+            }
+        }
+    }
+    if (!faces) {
+        return;
+    }
+    assert(faces * 4 <= UINT16_MAX + 1);
+
+    mesh->vertexes = arena_alloc(arena, sizeof(struct Vertex) * faces * 4);
+    mesh->indexes = arena_alloc(arena, sizeof(VertexIdx) * faces * 6);
+    assert(mesh->vertexes && mesh->indexes && "Out of memory!");
+    for (int i = 0; i < n * n * n; i++) {
+        if (!visible[i]) {
+            continue;
+        }
+        const int x = i % n, z = i / n % n, y = i / (n * n);
+        const struct LodCell *cell = &cells[(x + 1) + (z + 1) * stride + (y + 1) * stride * stride];
+        const uint8_t layer = block_get(cell->id)->texture;
+        for (int f = 0; f < 6; f++) {
+            if (!(visible[i] & (1 << f))) {
+                continue;
+            }
+            const int8_t *dir = lod_faces[f].dir;
+            const struct LodCell *next = &cells[(x + dir[0] + 1) + (z + dir[2] + 1) * stride + (y + dir[1] + 1) * stride * stride];
+            // Skirts look into their own cell's light as much as the next one's
+            const uint8_t light = LIGHT_PACK(
+                light_sky(next->light) > light_sky(cell->light) ? light_sky(next->light) : light_sky(cell->light),
+                light_block(next->light) > light_block(cell->light) ? light_block(next->light) : light_block(cell->light));
+            lod_emit_face(&lod_faces[f], x * size, y0 + y * size, z * size, size, light, layer, mesh);
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef _LOD_H
+#define _LOD_H
+#include <stdint.h>
+
+#include "mem.h"
+#include "mesh.h"
+#include "world.h"
+
+// Level 0 is full detail, every level after it merges 2x2x2 cells of the
+// one before, up to 8x8x8 blocks
+#define LOD_LEVELS 4
+// Chunks along each side of a region, they all get the same level so there
+// are only seams where regions meet
+#define LOD_REGION_CHUNKS 4
+// Blocks from the camera to a region's centre that still get full detail,
+// the distance for every level after that doubles
+#define LOD_FULL_DETAIL_DISTANCE 128.0f
+
+static inline int lod_cell_size(int level) {
+    return 1 << level;
+}
+// Level for the region chunk (x, z) is in, seen from (cam_x, cam_z)
+int lod_pick(float cam_x, float cam_z, int32_t x, int32_t z);
+// Like mesh_section but out of cells lod_cell_size(level) blocks across.
+// Cells are filled if at least half their blocks are, with the most common
+// block of their top layer. No ambient occlusion, light is the brightest
+// in the cell the face looks at. Faces on the chunk's sides are kept
+// unless the neighbour is solid all the way through the cell, so they
+// cover whatever gaps a neighbour at another level leaves.
+void lod_mesh_section(struct World *world, const struct Chunk *chunk, int sy, int level,
+                        struct Arena *arena, struct SectionMesh *mesh);
+
+#endif
@@ -0,0 +1,394 @@
+#include <assert.h>
+#include <string.h>
+
+#include "lz.h"
+
+// Sequence format (same idea as LZ4):
+//  token: high nibble literal count, low nibble match length - LZ_MIN_MATCH
+//         (15 in either means more length bytes follow, 255 = keep reading)
+//  literals
+//  u16 little endian match offset (the last sequence has none)
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+// No match can start in the last LZ_MF_LIMIT bytes, and the last
+// LZ_LAST_LITERALS bytes are always literals
+#define LZ_MF_LIMIT 12
+#define LZ_LAST_LITERALS 8
+// How fast the match finder speeds up over incompressible data
+#define LZ_SKIP_TRIGGER 6
+#define LZ_BLOCK_HEADER 8
+
+static inline uint32_t lz_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint64_t lz_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+static inline void lz_write_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+static inline uint32_t lz_read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Counts how many bytes match starting at p and m, stopping at limit
+static inline size_t lz_count(const uint8_t *p, const uint8_t *m, const uint8_t *limit) {
+    const uint8_t *start = p;
+    while (p + 8 <= limit) {
+        uint64_t diff = lz_read64(p) ^ lz_read64(m);
+        if (diff) {
+#if defined(__GNUC__)
+            return p - start + (__builtin_ctzll(diff) >> 3);
+#else
+            while (*p == *m) {
+                p++;
+                m++;
+            }
+            return p - start;
+#endif
+        }
+        p += 8;
+        m += 8;
+    }
+    while (p < limit && *p == *m) {
+        p++;
+        m++;
+    }
+    return p - start;
+}
+static inline uint8_t *lz_write_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+size_t lz_compress(const void *src, size_t src_size, void *dest, size_t dest_cap) {
+    assert(src_size < UINT32_MAX);
+    const uint8_t *const base = src, *const iend = base + src_size;
+    const uint8_t *const mflimit = src_size > LZ_MF_LIMIT ? iend - LZ_MF_LIMIT : base;
+    const uint8_t *const match_limit = src_size > LZ_MF_LIMIT ? iend - LZ_LAST_LITERALS : base;
+    const uint8_t *ip = base, *anchor = base;
+    uint8_t *op = dest, *const oend = op + dest_cap;
+    uint32_t table[1 << LZ_HASH_BITS];
+
+    if (src_size <= LZ_MF_LIMIT) {
+        goto last_literals;
+    }
+    memset(table, 0, sizeof(table));
+    ip++;
+
+    for (;;) {
+        const uint8_t *match;
+        size_t attempts = 1 << LZ_SKIP_TRIGGER, step = 1;
+
+        // Find a match (voxel data has lots of runs so this is usually quick)
+        for (;;) {
+            if (ip > mflimit) {
+                goto last_literals;
+            }
+            uint32_t seq = lz_read32(ip), h = lz_hash(seq);
+            match = base + table[h];
+            table[h] = ip - base;
+            if (match < ip && ip - match <= LZ_MAX_OFFSET && lz_read32(match) == seq) {
+                break;
+            }
+            ip += step;
+            step = attempts++ >> LZ_SKIP_TRIGGER;
+        }
+        while (ip > anchor && match > base && ip[-1] == match[-1]) {
+            ip--;
+            match--;
+        }
+
+        size_t lit = ip - anchor;
+        size_t mlen = LZ_MIN_MATCH + lz_count(ip + LZ_MIN_MATCH, match + LZ_MIN_MATCH, match_limit);
+        if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + (mlen - LZ_MIN_MATCH) / 255 + 1) {
+            return 0;
+        }
+
+        uint8_t *token = op++;
+        if (lit >= 15) {
+            *token = 15 << 4;
+            op = lz_write_length(op, lit - 15);
+        } else {
+            *token = lit << 4;
+        }
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op++ = (ip - match);
+        *op++ = (ip - match) >> 8;
+        if (mlen - LZ_MIN_MATCH >= 15) {
+            *token |= 15;
+            op = lz_write_length(op, mlen - LZ_MIN_MATCH - 15);
+        } else {
+            *token |= mlen - LZ_MIN_MATCH;
+        }
+
+        ip += mlen;
+        anchor = ip;
+        if (ip > mflimit) {
+            goto last_literals;
+        }
+        // Keep the table fresh so runs right after this match are found
+        table[lz_hash(lz_read32(ip - 2))] = ip - 2 - base;
+    }
+
+last_literals: {
+    size_t lit = iend - anchor;
+    if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit) {
+        return 0;
+    }
+    if (lit >= 15) {
+        *op++ = 15 << 4;
+        op = lz_write_length(op, lit - 15);
+    } else {
+        *op++ = lit << 4;
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - (uint8_t *)dest;
+}
+}
+
+// Reads the extra bytes of a length, returns false on a truncated stream
+static inline bool lz_read_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+// Copies a possibly overlapping match, may write up to 8 bytes past the end
+static inline void lz_copy_match(uint8_t *op, size_t offset, size_t len) {
+    const uint8_t *match = op - offset;
+    uint8_t *const end = op + len;
+
+    if (offset < 8) {
+        if (offset == 1) {
+            memset(op, *match, len);
+            return;
+        }
+        // Short offsets are runs of a small pattern. Repeat the pattern until
+        // it is at least 8 bytes long then copy it a word at a time.
+        size_t dist = offset;
+        while (dist < 8) {
+            dist += offset;
+        }
+        for (size_t i = 0; i < dist && op < end; i++) {
+            *op++ = *match++;
+        }
+        match = op - dist;
+    }
+    while (op < end) {
+        memcpy(op, match, 8);
+        op += 8;
+        match += 8;
+    }
+}
+
+size_t lz_decompress(const void *src, size_t src_size, void *dest, size_t dest_cap) {
+    const uint8_t *ip = src, *const iend = ip + src_size;
+    uint8_t *op = dest, *const oend = op + dest_cap;
+
+    while (ip < iend) {
+        const uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !lz_read_length(&ip, iend, &lit)) {
+            return 0;
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            return 0;
+        }
+        if (lit <= 16 && iend - ip >= 16 && oend - op >= 16) {
+            memcpy(op, ip, 16);
+        } else {
+            memcpy(op, ip, lit);
+        }
+        ip += lit;
+        op += lit;
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return 0;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && !lz_read_length(&ip, iend, &mlen)) {
+            return 0;
+        }
+        mlen += LZ_MIN_MATCH;
+        if (!offset || offset > (size_t)(op - (uint8_t *)dest) || mlen > (size_t)(oend - op)) {
+            return 0;
+        }
+
+        if (mlen + 8 <= (size_t)(oend - op)) {
+            lz_copy_match(op, offset, mlen);
+        } else {
+            const uint8_t *match = op - offset;
+            for (size_t i = 0; i < mlen; i++) {
+                op[i] = match[i];
+            }
+        }
+        op += mlen;
+    }
+
+    return op - (uint8_t *)dest;
+}
+
+void lz_writer_begin(struct LzWriter *writer, struct Arena *arena) {
+    writer->arena = arena;
+    writer->first = NULL;
+    writer->last = NULL;
+    writer->raw_size = 0;
+    writer->compressed_size = 0;
+    writer->pending = arena_alloc(arena, LZ_BLOCK_SIZE);
+    writer->scratch = arena_alloc(arena, LZ_COMPRESS_BOUND(LZ_BLOCK_SIZE));
+    writer->pending_len = 0;
+}
+static void lz_writer_flush(struct LzWriter *writer) {
+    if (!writer->pending_len) {
+        return;
+    }
+
+    size_t size = lz_compress(writer->pending, writer->pending_len,
+                                writer->scratch, LZ_COMPRESS_BOUND(LZ_BLOCK_SIZE));
+    const uint8_t *data = writer->scratch;
+    if (!size || size >= writer->pending_len) {
+        size = writer->pending_len;
+        data = writer->pending;
+    }
+
+    struct LzStreamBlock *block = arena_alloc(writer->arena, sizeof(*block) + LZ_BLOCK_HEADER + size);
+    block->next = NULL;
+    block->size = LZ_BLOCK_HEADER + size;
+    lz_write_u32(block->data, writer->pending_len);
+    lz_write_u32(block->data + 4, size);
+    memcpy(block->data + LZ_BLOCK_HEADER, data, size);
+    if (writer->last) {
+        writer->last->next = block;
+    } else {
+        writer->first = block;
+    }
+    writer->last = block;
+
+    writer->raw_size += writer->pending_len;
+    writer->compressed_size += block->size;
+    writer->pending_len = 0;
+}
+void lz_writer_write(struct LzWriter *writer, const void *_data, size_t size) {
+    const uint8_t *data = _data;
+    while (size) {
+        size_t n = LZ_BLOCK_SIZE - writer->pending_len;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(writer->pending + writer->pending_len, data, n);
+        writer->pending_len += n;
+        data += n;
+        size -= n;
+        if (writer->pending_len == LZ_BLOCK_SIZE) {
+            lz_writer_flush(writer);
+        }
+    }
+}
+uint8_t *lz_writer_end(struct LzWriter *writer, size_t *size) {
+    lz_writer_flush(writer);
+    *size = writer->compressed_size;
+
+    uint8_t *buf = arena_alloc(writer->arena, writer->compressed_size ? writer->compressed_size : 1);
+    uint8_t *p = buf;
+    for (struct LzStreamBlock *block = writer->first; block; block = block->next) {
+        memcpy(p, block->data, block->size);
+        p += block->size;
+    }
+    return buf;
+}
+
+void lz_reader_begin(struct LzReader *reader, struct Arena *arena, const void *src, size_t size) {
+    reader->src = src;
+    reader->end = reader->src + size;
+    reader->block = arena_alloc(arena, LZ_BLOCK_SIZE);
+    reader->block_len = 0;
+    reader->block_off = 0;
+    reader->corrupt = false;
+}
+// Decodes the next block into dest, returns its size or 0 at the end/on error
+static size_t lz_reader_decode(struct LzReader *reader, uint8_t *dest) {
+    if (reader->src == reader->end) {
+        return 0;
+    }
+    if (reader->end - reader->src < LZ_BLOCK_HEADER) {
+        reader->corrupt = true;
+        return 0;
+    }
+
+    uint32_t raw = lz_read_u32(reader->src), size = lz_read_u32(reader->src + 4);
+    const uint8_t *data = reader->src + LZ_BLOCK_HEADER;
+    if (!raw || raw > LZ_BLOCK_SIZE || size > (size_t)(reader->end - data)) {
+        reader->corrupt = true;
+        return 0;
+    }
+    if (size == raw) {
+        memcpy(dest, data, raw);
+    } else if (lz_decompress(data, size, dest, raw) != raw) {
+        reader->corrupt = true;
+        return 0;
+    }
+    reader->src = data + size;
+    return raw;
+}
+size_t lz_reader_read(struct LzReader *reader, void *_dest, size_t size) {
+    uint8_t *dest = _dest;
+    size_t read = 0;
+
+    while (read < size) {
+        if (reader->block_off == reader->block_len) {
+            // Whole blocks go straight into the destination
+            if (size - read >= LZ_BLOCK_SIZE) {
+                size_t n = lz_reader_decode(reader, dest + read);
+                if (!n) {
+                    break;
+                }
+                read += n;
+                continue;
+            }
+            reader->block_len = lz_reader_decode(reader, reader->block);
+            reader->block_off = 0;
+            if (!reader->block_len) {
+                break;
+            }
+        }
+
+        size_t n = reader->block_len - reader->block_off;
+        if (n > size - read) {
+            n = size - read;
+        }
+        memcpy(dest + read, reader->block + reader->block_off, n);
+        reader->block_off += n;
+        read += n;
+    }
+
+    return read;
+}
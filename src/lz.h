@@ -0,0 +1,51 @@
+#ifndef _LZ_H
+#define _LZ_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+
+// Biggest amount of raw data that goes into one stream block
+#define LZ_BLOCK_SIZE (64 * 1024)
+// Worst case compressed size of size bytes of input
+#define LZ_COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+// Returns the compressed size, or 0 if dest_cap is too small
+size_t lz_compress(const void *src, size_t src_size, void *dest, size_t dest_cap);
+// Returns the decompressed size, or 0 if the data is corrupt or dest_cap is too small
+size_t lz_decompress(const void *src, size_t src_size, void *dest, size_t dest_cap);
+
+// Stream format is a list of blocks, each prefixed with its raw and
+// compressed sizes (little endian u32). Blocks that don't compress are stored raw.
+struct LzStreamBlock {
+    struct LzStreamBlock *next;
+    size_t size;
+    uint8_t data[];
+};
+struct LzWriter {
+    struct Arena *arena;
+    struct LzStreamBlock *first, *last;
+    size_t raw_size, compressed_size;
+    uint8_t *pending, *scratch;
+    size_t pending_len;
+};
+struct LzReader {
+    const uint8_t *src, *end;
+    uint8_t *block;
+    size_t block_len, block_off;
+    bool corrupt;
+};
+
+// All buffers of the stream (and the final output) come from the arena
+void lz_writer_begin(struct LzWriter *writer, struct Arena *arena);
+void lz_writer_write(struct LzWriter *writer, const void *data, size_t size);
+// Returns the whole compressed stream as one buffer allocated from the arena
+uint8_t *lz_writer_end(struct LzWriter *writer, size_t *size);
+
+void lz_reader_begin(struct LzReader *reader, struct Arena *arena, const void *src, size_t size);
+// Returns the number of bytes read, less than size on the end of the stream
+// or when the stream is corrupt (reader->corrupt is set then)
+size_t lz_reader_read(struct LzReader *reader, void *dest, size_t size);
+
+#endif
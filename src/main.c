@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <string.h>
 #include <math.h>
 
 #include "window.h"
@@ -9,6 +10,15 @@
 #include "texture.h"
 #include "system.h"
 #include "camera.h"
+#include "world.h"
+#include "save.h"
+#include "cache.h"
+#include "stream.h"
+#include "lod.h"
+#include "profile.h"
+#include "gpuprofile.h"
+#include "render.h"
+#include "slab.h"
 
 struct Vertex verticies[] = {
     { .pos = {-0.5f,  0.5f,  0.0f, }, .uv = { 0.0f, 0.0f, }, },
@@ -21,32 +31,265 @@ VertexIdx indicies[] = {
     2, 3, 1,
 };
 
+// Units per second
+#define CAMERA_FORWARD_SPEED 3.0f
+#define CAMERA_STRAFE_SPEED 2.4f
+#define TICK_RATE 60
+// Every 16x16 tile in terrain.png, blocks pick theirs by index
+#define TERRAIN_TILES 256
+// Live bytes past these print an error
+#define WORLD_MEMORY_BUDGET (1024ull * 1024 * 1024)
+#define SCRATCH_MEMORY_BUDGET (64ull * 1024 * 1024)
+// In chunks
+#define VIEW_DISTANCE 12
+// Compressed chunks kept around after they go out of view
+#define CHUNK_CACHE_BUDGET (128ull * 1024 * 1024)
+// Where the camera starts, just above generate_flat's grass
+#define SPAWN_HEIGHT 66.0f
+// Mesh handles the scene has room for before it grows
+#define SCENE_INITIAL_CHUNKS 1024
+
+static void camera_move(struct Camera *cam, const uint8_t *keys, float dt) {
+    float movespd = (float)((keys[SDL_SCANCODE_W] != 0) -
+        (keys[SDL_SCANCODE_S] != 0)) * CAMERA_FORWARD_SPEED * dt;
+    float movespd2 = (float)((keys[SDL_SCANCODE_A] != 0) -
+        (keys[SDL_SCANCODE_D] != 0)) * CAMERA_STRAFE_SPEED * dt;
+
+    vec3 cam_normal = { 0.0f, 0.0f, -1.0f }, cam_tangent;
+    glm_vec3_rotate(cam_normal, cam->xrot, (vec3){ 1.0f, 0.0f, 0.0f });
+    glm_vec3_rotate(cam_normal, cam->yrot, (vec3){ 0.0f, 1.0f, 0.0f });
+    glm_vec3_cross(cam_normal, (vec3){ 0.0f, 1.0f, 0.0f }, cam_tangent);
+    glm_vec3_normalize(cam_tangent);
+    glm_vec3_scale(cam_normal, movespd, cam_normal);
+    glm_vec3_add(cam_normal, cam->pos, cam->pos);
+    glm_vec3_scale(cam_tangent, -movespd2, cam_tangent);
+    glm_vec3_add(cam_tangent, cam->pos, cam->pos);
+}
+
+// Stone with a bit of dirt and grass on top, until there's real terrain
+static void generate_flat(struct World *world, struct Chunk *chunk, void *data) {
+    (void)data;
+    for (int sy = 0; sy < 3; sy++) {
+        chunk->uniform[sy] = BLOCK_STONE;
+    }
+    chunk->uniform[3] = BLOCK_DIRT;
+    struct Section *section = chunk_get_writable_section(world, chunk, 3);
+    for (int z = 0; z < CHUNK_WIDTH; z++) {
+        for (int x = 0; x < CHUNK_WIDTH; x++) {
+            section->blocks[section_block_index(x, SECTION_HEIGHT - 1, z)] = BLOCK_GRASS;
+        }
+    }
+}
+
+static struct ShaderResult shader_load(const char *vertex_path, const char *fragment_path, UniformLoader uniforms) {
+    struct Arena *scratch = scratch_arena();
+    struct ArenaMark scratch_mark = arena_mark(scratch);
+    char *vertex = file_load_as_string(arena_alloc_interface(), scratch, vertex_path),
+        *fragment = file_load_as_string(arena_alloc_interface(), scratch, fragment_path);
+    struct ShaderResult result = shader_create(vertex, fragment, uniforms);
+    arena_rewind(scratch, scratch_mark);
+    return result;
+}
+
+// Runs on the game thread whenever the streamer meshes a chunk, and with
+// no meshes right before it unloads one
+static void chunk_meshed(struct Chunk *chunk, const struct SectionMesh meshes[CHUNK_SECTIONS], void *data) {
+    struct Renderer *renderer = data;
+    if (!meshes) {
+        if (chunk->mesh) {
+            renderer_mesh_destroy(renderer, chunk->mesh);
+            chunk->mesh = 0;
+        }
+        return;
+    }
+    if (!chunk->mesh) {
+        chunk->mesh = renderer_mesh_create(renderer);
+    }
+    renderer_mesh_upload(renderer, chunk->mesh, meshes);
+}
+// The chunks cam can see, as far as they fit
+static void list_chunks(struct Streamer *streamer, struct Camera *cam, struct RenderSnapshot *snapshot) {
+    struct Arena *scratch = scratch_arena();
+    struct ArenaMark scratch_mark = arena_mark(scratch);
+    struct Chunk **visible = arena_alloc(scratch, sizeof(struct Chunk *) * RENDER_MAX_CHUNKS);
+    assert(visible && "Out of memory!");
+    const size_t num_visible = streamer_visible(streamer, cam, visible, RENDER_MAX_CHUNKS);
+
+    snapshot->num_chunks = 0;
+    for (size_t i = 0; i < num_visible; i++) {
+        const struct Chunk *chunk = visible[i];
+        if (!chunk->mesh) {
+            continue;
+        }
+        snapshot->chunks[snapshot->num_chunks++] = (struct RenderChunk) {
+            .mesh = chunk->mesh,
+            .lod = chunk->lod,
+            .origin = { (float)(chunk->x * CHUNK_WIDTH), 0.0f, (float)(chunk->z * CHUNK_WIDTH) },
+        };
+    }
+    arena_rewind(scratch, scratch_mark);
+}
+
+// A model per section of one chunk, sections without faces have none (vao 0)
+struct ChunkModels {
+    struct Model sections[CHUNK_SECTIONS];
+};
+// GL resources the render thread draws with
+struct Scene {
+    struct Shader *shader, *chunk_shader;
+    struct Model *model;
+    struct UniformMatrices *matricies;
+    // By mesh handle
+    struct ChunkModels *chunks;
+    size_t chunks_cap;
+    // Chunk triangles drawn at each level of detail, over every frame
+    uint64_t frames, triangles[LOD_LEVELS];
+};
+
+static void scene_free_chunk(struct ChunkModels *chunk) {
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        if (chunk->sections[sy].vao) {
+            model_destroy(&chunk->sections[sy]);
+            chunk->sections[sy] = (struct Model) {0};
+        }
+    }
+}
+static void scene_update_chunk(struct Scene *scene, const struct RenderMeshUpdate *update) {
+    if (update->mesh >= scene->chunks_cap) {
+        const size_t old_cap = scene->chunks_cap;
+        while (update->mesh >= scene->chunks_cap) {
+            scene->chunks_cap *= 2;
+        }
+        scene->chunks = mem_realloc(scene->chunks, sizeof(struct ChunkModels) * scene->chunks_cap);
+        assert(scene->chunks && "Out of memory!");
+        memset(&scene->chunks[old_cap], 0, sizeof(struct ChunkModels) * (scene->chunks_cap - old_cap));
+    }
+    struct ChunkModels *chunk = &scene->chunks[update->mesh];
+    if (update->drop) {
+        scene_free_chunk(chunk);
+        return;
+    }
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        const struct SectionMesh *mesh = &update->sections[sy];
+        struct Model *model = &chunk->sections[sy];
+        if (!mesh->num_indexes) {
+            if (model->vao) {
+                model_destroy(model);
+                *model = (struct Model) {0};
+            }
+            continue;
+        }
+        if (!model->vao) {
+            *model = model_create(vertex_attrib_creator, NULL, scene->chunk_shader);
+        }
+        model_buffer_vertexes(model, mesh->vertexes, mesh->num_vertexes, GL_STATIC_DRAW);
+        model_buffer_elements(model, mesh->indexes, mesh->num_indexes, GL_STATIC_DRAW);
+    }
+}
+// Needs the GL context
+static void scene_destroy_chunks(struct Scene *scene) {
+    for (size_t i = 0; i < scene->chunks_cap; i++) {
+        scene_free_chunk(&scene->chunks[i]);
+    }
+    mem_free(scene->chunks);
+}
+static void scene_print_stats(const struct Scene *scene) {
+    printf("scene: chunk triangles per frame by level of detail");
+    for (int level = 0; level < LOD_LEVELS; level++) {
+        printf(" %d: %llu", level, (unsigned long long)(scene->frames ? scene->triangles[level] / scene->frames : 0));
+    }
+    printf("\n");
+}
+
+static void scene_draw(struct Renderer *renderer, const struct RenderSnapshot *snapshot, void *data) {
+    struct Scene *scene = data;
+    {
+        PROFILE_ZONE("upload");
+        glm_mat4_copy((vec4 *)snapshot->proj, scene->matricies[0].proj);
+        glm_mat4_copy((vec4 *)snapshot->view, scene->matricies[0].view);
+        uniformbuffer_update_instances(scene->matricies, 0, 1);
+        model_buffer_instances(scene->model, snapshot->instances, snapshot->num_instances, GL_STREAM_DRAW);
+        for (const struct RenderMeshUpdate *update = snapshot->mesh_updates; update; update = update->next) {
+            scene_update_chunk(scene, update);
+        }
+    }
+
+    PROFILE_ZONE("draw");
+    GPU_ZONE_BEGIN(renderer->gpu_prof, "clear");
+    glClearColor(0.2f, 0.5f, 0.9f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    GPU_ZONE_END(renderer->gpu_prof);
+    GPU_ZONE_BEGIN(renderer->gpu_prof, "chunks");
+    shader_use(scene->chunk_shader);
+    for (size_t i = 0; i < snapshot->num_chunks; i++) {
+        const struct RenderChunk *chunk = &snapshot->chunks[i];
+        assert(chunk->mesh < scene->chunks_cap);
+        shader_set_vec3(scene->chunk_shader->uniforms.chunk.origin, (float *)chunk->origin);
+        for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+            struct Model *model = &scene->chunks[chunk->mesh].sections[sy];
+            if (model->vao) {
+                model_bind(model);
+                model_draw(model);
+                scene->triangles[chunk->lod] += model->num_indicies / 3;
+            }
+        }
+    }
+    scene->frames++;
+    GPU_ZONE_END(renderer->gpu_prof);
+    GPU_ZONE_BEGIN(renderer->gpu_prof, "draw");
+    shader_use(scene->shader);
+    model_bind(scene->model);
+    model_draw(scene->model);
+    GPU_ZONE_END(renderer->gpu_prof);
+}
+
 int main(int argc, char **argv) {
+    time_init();
+    profile_init();
+    slab_init();
+    mem_set_budget(MEM_TAG_WORLD, WORLD_MEMORY_BUDGET);
+    mem_set_budget(MEM_TAG_SCRATCH, SCRATCH_MEMORY_BUDGET);
+    PROFILE_THREAD("main");
     struct Window window = window_create();
-    struct Arena *arena = arena_create(1024 * 1024);
     if (window.error_code != 0) {
         return window.error_code;
     }
 
     // Application
+    struct GpuProfiler gpu_prof;
+    gpu_profiler_init(&gpu_prof);
     glEnable(GL_DEPTH_TEST);
-    char *vertex = file_load_as_string(arena_alloc_interface(), arena, "assets/shaders/test.vs"),
-        *fragment = file_load_as_string(arena_alloc_interface(), arena, "assets/shaders/test.fs");
-    struct ShaderResult shader_result = shader_create(vertex, fragment, textured_shader_uniforms);
+    struct ShaderResult shader_result = shader_load("assets/shaders/test.vs", "assets/shaders/test.fs",
+                                                    textured_shader_uniforms);
     if (!shader_result.valid) {
         goto cleanup;
     }
+    // Same fragment shader, chunk meshes carry their own light and texture layer
+    struct ShaderResult chunk_shader = shader_load("assets/shaders/chunk.vs", "assets/shaders/test.fs",
+                                                    chunk_shader_uniforms);
+    if (!chunk_shader.valid) {
+        shader_destroy(&chunk_shader.program);
+        shader_destroy(&shader_result.program);
+        goto cleanup;
+    }
+    shader_use(&chunk_shader.program);
+    shader_set_int(chunk_shader.program.uniforms.chunk.texture, 0);
     shader_use(&shader_result.program);
     shader_set_int(shader_result.program.uniforms.textured.texture, 0);
     struct Model model = model_create(vertex_attrib_creator, model_matrix_attrib_creator, &shader_result.program);
     model_buffer_vertexes(&model, verticies, ARRAY_SIZE(verticies), GL_STATIC_DRAW);
     model_buffer_elements(&model, indicies, ARRAY_SIZE(indicies), GL_STATIC_DRAW);
-    struct Texture terrain = texture_array_create_empty(GL_NEAREST, true, 25, 16, 16);
+    struct Texture terrain = texture_array_create_empty(GL_NEAREST, true, TERRAIN_TILES, 16, 16);
     struct UniformMatrices *matricies = uniformbuffer_create(0, sizeof(struct UniformMatrices), 1, GL_STREAM_DRAW);
     struct Camera cam = camera_create(glm_rad(70.0f), 0.001f, 10000.0f);
+    cam.pos[1] = SPAWN_HEIGHT;
+    struct World *world = world_create();
+    struct Autosave *autosave = autosave_create(world, "world", 30.0);
+    struct ChunkCache *chunk_cache = chunk_cache_create(CHUNK_CACHE_BUDGET);
 
     struct Image terrain_img = image_create_from_file("assets/textures/terrain.png");
-    for (int i = 0; i < 25; i++) {
+    GPU_ZONE_BEGIN(&gpu_prof, "texture_upload");
+    for (int i = 0; i < TERRAIN_TILES; i++) {
         texture_array_load_subimage(
             &terrain,
             i,
@@ -56,6 +299,7 @@ int main(int argc, char **argv) {
         );
     }
     texture_draw_image(&terrain, &terrain_img, 0, 0, 256, 256);
+    GPU_ZONE_END(&gpu_prof);
     image_destroy(&terrain_img);
 
     mat4 models[5*5];
@@ -63,67 +307,135 @@ int main(int argc, char **argv) {
         for (int y = -2; y <= 2; y++) {
             mat4 *m = &models[(y + 2) * 5 + (x + 2)];
             glm_mat4_identity(*m);
-            glm_translate(*m, (vec3){ (float)x * 1.3f, (float)y * 1.3f, -4.0f });
+            glm_translate(*m, (vec3){ (float)x * 1.3f, (float)y * 1.3f + SPAWN_HEIGHT, -4.0f });
         }
     }
-    model_buffer_instances(&model, models, 25, GL_STATIC_DRAW);
 
     texture_activate(&terrain, 0);
     shader_use(&shader_result.program);
     uniformbuffer_bind(matricies, 0);
     shader_set_binding(&shader_result.program, matricies, "Matrices");
+    shader_set_binding(&chunk_shader.program, matricies, "Matrices");
     model_bind(&model);
     window.lock_mouse = true;
 
+    struct Scene scene = (struct Scene) {
+        .shader = &shader_result.program,
+        .chunk_shader = &chunk_shader.program,
+        .model = &model,
+        .matricies = matricies,
+        .chunks = mem_alloc_tagged(sizeof(struct ChunkModels) * SCENE_INITIAL_CHUNKS, MEM_TAG_RENDER),
+        .chunks_cap = SCENE_INITIAL_CHUNKS,
+    };
+    assert(scene.chunks && "Out of memory!");
+    memset(scene.chunks, 0, sizeof(struct ChunkModels) * scene.chunks_cap);
+    struct Renderer *renderer = renderer_create(&window, &gpu_prof, scene_draw, &scene);
+    if (!renderer) {
+        window.error_code = 1;
+        goto cleanup_resources;
+    }
+    struct Streamer *streamer = streamer_create(world, autosave, chunk_cache, VIEW_DISTANCE,
+                                                generate_flat, chunk_meshed, renderer);
+
+    struct FrameStats frame_stats;
+    frame_stats_init(&frame_stats);
+    struct TickClock tick_clock;
+    tick_clock_init(&tick_clock, TICK_RATE);
+    struct Camera prev_cam = cam;
+    bool dump_key_down = false;
     while (!window.wants_to_close) {
-        window_handle_events(&window);
+        PROFILE_ZONE("frame");
+        frame_stats_tick(&frame_stats);
+        scratch_next_frame();
+        mem_track_next_frame();
+        {
+            PROFILE_ZONE("events");
+            window_handle_events(&window);
+        }
 
         const uint8_t *keys = SDL_GetKeyboardState(NULL);
-        float movespd = (float)((keys[SDL_SCANCODE_W] != 0) -
-            (keys[SDL_SCANCODE_S] != 0)) * 0.05f;
-        float movespd2 = (float)((keys[SDL_SCANCODE_A] != 0) -
-            (keys[SDL_SCANCODE_D] != 0)) * 0.04f;
-
-        // Move the camera
-        cam.xrot -= window.mouse_dy;
-        if (cam.xrot > M_PI_2) {
-            cam.xrot = M_PI_2;
-        } else if (cam.xrot < -M_PI_2) {
-            cam.xrot = -M_PI_2;
+        if (keys[SDL_SCANCODE_F9] && !dump_key_down) {
+            profile_dump_chrome("profile.json");
         }
-        cam.yrot -= window.mouse_dx;
-        
-        vec3 cam_normal = { 0.0f, 0.0f, -1.0f }, cam_tangent;
-        glm_vec3_rotate(cam_normal, cam.xrot, (vec3){ 1.0f, 0.0f, 0.0f });
-        glm_vec3_rotate(cam_normal, cam.yrot, (vec3){ 0.0f, 1.0f, 0.0f });
-        glm_vec3_cross(cam_normal, (vec3){ 0.0f, 1.0f, 0.0f }, cam_tangent);
-        glm_vec3_normalize(cam_tangent);
-        glm_vec3_scale(cam_normal, movespd, cam_normal);
-        glm_vec3_add(cam_normal, cam.pos, cam.pos);
-        glm_vec3_scale(cam_tangent, -movespd2, cam_tangent);
-        glm_vec3_add(cam_tangent, cam.pos, cam.pos);
-
-        camera_update(&cam, &window);
-        camera_get_proj(&cam, matricies[0].proj);
-        camera_get_view(&cam, matricies[0].view);
-        uniformbuffer_update_instances(matricies, 0, 1);
-
-        glClearColor(0.2f, 0.5f, 0.9f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        model_bind(&model);
-        model_draw(&model);
-
-        SDL_GL_SwapWindow(window.window);
+        dump_key_down = keys[SDL_SCANCODE_F9];
+        struct Camera view_cam;
+        {
+            // Mouse look isn't part of the simulation, it always follows the mouse
+            PROFILE_ZONE("camera");
+            cam.xrot -= window.mouse_dy;
+            if (cam.xrot > M_PI_2) {
+                cam.xrot = M_PI_2;
+            } else if (cam.xrot < -M_PI_2) {
+                cam.xrot = -M_PI_2;
+            }
+            cam.yrot -= window.mouse_dx;
+            prev_cam.xrot = cam.xrot;
+            prev_cam.yrot = cam.yrot;
+
+            uint32_t ticks = tick_clock_advance(&tick_clock);
+            for (uint32_t i = 0; i < ticks; i++) {
+                PROFILE_ZONE("tick");
+                prev_cam = cam;
+                camera_move(&cam, keys, tick_clock_dt(&tick_clock));
+            }
+
+            struct RenderSnapshot *snapshot = renderer_begin_frame(renderer);
+            camera_lerp(&prev_cam, &cam, tick_clock_alpha(&tick_clock), &view_cam);
+            camera_update(&view_cam, &window);
+            camera_get_proj(&view_cam, snapshot->proj);
+            camera_get_view(&view_cam, snapshot->view);
+            snapshot->w = window.w;
+            snapshot->h = window.h;
+            snapshot->num_instances = ARRAY_SIZE(models);
+            memcpy(snapshot->instances, models, sizeof(models));
+            list_chunks(streamer, &view_cam, snapshot);
+        }
+
+        renderer_submit(renderer);
+        // While the render thread is busy with the frame (on macOS it was drawn already)
+        streamer_update(streamer, &view_cam);
+        if (autosave) {
+            PROFILE_ZONE("autosave");
+            autosave_update(autosave);
+        }
+        light_update(world);
+        world_trim(world);
     }
 
+    renderer_destroy(renderer);
+    frame_stats_print(&frame_stats);
+    scene_print_stats(&scene);
+    streamer_print_stats(streamer);
+    streamer_destroy(streamer);
+
 cleanup_resources:
+    scene_destroy_chunks(&scene);
+    chunk_cache_print_stats(chunk_cache);
+    chunk_cache_destroy(chunk_cache);
+    if (autosave) {
+        autosave_destroy(autosave);
+    }
+    world_print_stats(world);
+    world_destroy(world);
     uniformbuffer_destroy(matricies);
+    shader_destroy(&chunk_shader.program);
     shader_destroy(&shader_result.program);
     model_destroy(&model);
     texture_destroy(&terrain);
+    gpu_profiler_destroy(&gpu_prof);
 
 cleanup:
-    arena_destroy(arena);
+    scratch_thread_shutdown();
+    slab_thread_shutdown();
+    mem_thread_shutdown();
+    slab_shutdown();
     window_destroy(&window);
+#ifdef PROFILE_ENABLED
+    profile_shutdown("profile.json");
+#else
+    profile_shutdown(NULL);
+#endif
+    mem_print_stats();
+    mem_report_leaks();
     return window.error_code;
 }
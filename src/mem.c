@@ -1,28 +1,177 @@
 #include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
 
 #include "mem.h"
 
-inline void *mem_alloc(size_t size) {
+// Orphan stack head is a chunk pointer with a push count in the top bits,
+// user space addresses fit in 48 bits on every 64 bit target we build for
+#define SHARED_POOL_TAG_SHIFT 48
+#define SHARED_POOL_PTR_MASK ((UINT64_C(1) << SHARED_POOL_TAG_SHIFT) - 1)
+// Pages are committed this much at a time so growing isn't a syscall per page
+#define VM_ARENA_COMMIT_STEP (64 * 1024)
+
+const char *const mem_tag_names[MEM_TAG_COUNT] = {
+    [MEM_TAG_GENERAL] = "general",
+    [MEM_TAG_WORLD] = "world",
+    [MEM_TAG_SAVE] = "save",
+    [MEM_TAG_RENDER] = "render",
+    [MEM_TAG_PROFILE] = "profile",
+    [MEM_TAG_SCRATCH] = "scratch",
+    [MEM_TAG_SLAB] = "slab",
+    [MEM_TAG_CACHE] = "cache",
+};
+
+#ifdef MEM_TRACKING_ENABLED
+// Every block gets one in front, it keeps the alignment malloc gives
+#define MEM_HEADER_MAGIC 0x4D454D54 // "MEMT"
+struct MemHeader {
+    size_t size;
+    uint32_t tag, magic;
+};
+struct MemTagStats {
+    atomic_size_t live, peak, count, total;
+    size_t budget;
+    atomic_bool over_budget;
+};
+
+_Thread_local enum MemTag mem_current_tag;
+static struct MemTagStats mem_tag_stats[MEM_TAG_COUNT];
+static atomic_size_t mem_frame_allocs;
+// Only touched by the main thread
+static size_t mem_frames, mem_frame_allocs_total, mem_frame_allocs_max;
+
+// Bytes only count towards live/peak, allocs also count towards the totals
+static void mem_track(enum MemTag tag, ptrdiff_t bytes, int allocs) {
+    struct MemTagStats *stats = &mem_tag_stats[tag];
+    size_t live = atomic_fetch_add_explicit(&stats->live, bytes, memory_order_relaxed) + bytes;
+    if (allocs) {
+        atomic_fetch_add_explicit(&stats->count, allocs, memory_order_relaxed);
+    }
+    if (allocs > 0) {
+        atomic_fetch_add_explicit(&stats->total, allocs, memory_order_relaxed);
+        atomic_fetch_add_explicit(&mem_frame_allocs, allocs, memory_order_relaxed);
+    }
+
+    size_t peak = atomic_load_explicit(&stats->peak, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(&stats->peak, &peak, live,
+                                                                    memory_order_relaxed, memory_order_relaxed));
+    if (stats->budget) {
+        bool over = live > stats->budget;
+        if (atomic_exchange_explicit(&stats->over_budget, over, memory_order_relaxed) != over && over) {
+            printf("mem error: %s is over its budget (%zu > %zu bytes)\n",
+                    mem_tag_names[tag], live, stats->budget);
+        }
+    }
+}
+void mem_set_budget(enum MemTag tag, size_t bytes) {
+    mem_tag_stats[tag].budget = bytes;
+}
+void mem_track_next_frame(void) {
+    size_t allocs = atomic_exchange_explicit(&mem_frame_allocs, 0, memory_order_relaxed);
+    mem_frames++;
+    mem_frame_allocs_total += allocs;
+    if (allocs > mem_frame_allocs_max) {
+        mem_frame_allocs_max = allocs;
+    }
+}
+size_t mem_tag_live_bytes(enum MemTag tag) {
+    return atomic_load_explicit(&mem_tag_stats[tag].live, memory_order_relaxed);
+}
+void mem_print_stats(void) {
+    printf("%-8s %12s %12s %10s %10s\n", "tag", "live KiB", "peak KiB", "live", "allocs");
+    for (size_t i = 0; i < MEM_TAG_COUNT; i++) {
+        struct MemTagStats *stats = &mem_tag_stats[i];
+        printf("%-8s %12zu %12zu %10zu %10zu\n", mem_tag_names[i],
+                atomic_load(&stats->live) / 1024, atomic_load(&stats->peak) / 1024,
+                atomic_load(&stats->count), atomic_load(&stats->total));
+    }
+    if (mem_frames) {
+        printf("allocations per frame: avg %.1f, max %zu\n",
+                (double)mem_frame_allocs_total / (double)mem_frames, mem_frame_allocs_max);
+    }
+}
+bool mem_report_leaks(void) {
+    bool clean = true;
+    for (size_t i = 0; i < MEM_TAG_COUNT; i++) {
+        size_t live = atomic_load(&mem_tag_stats[i].live), count = atomic_load(&mem_tag_stats[i].count);
+        if (live || count) {
+            printf("mem error: %s leaked %zu bytes in %zu allocations\n", mem_tag_names[i], live, count);
+            clean = false;
+        }
+    }
+    return clean;
+}
+// For memory that doesn't come from mem_alloc (like committed vm arena pages)
+# define MEM_TRACK_BYTES(tag, bytes) mem_track(tag, bytes, 0)
+// Same but counted as a block, allocs is 1 or -1
+# define MEM_TRACK_BLOCK(tag, bytes, allocs) mem_track(tag, bytes, allocs)
+#else
+# define MEM_TRACK_BYTES(tag, bytes) (void)0
+# define MEM_TRACK_BLOCK(tag, bytes, allocs) (void)0
+#endif
+
+void *mem_alloc_tagged(size_t size, enum MemTag tag) {
     assert(size);
+#ifdef MEM_TRACKING_ENABLED
+    struct MemHeader *header = malloc(sizeof(struct MemHeader) + size);
+    if (!header) {
+        return NULL;
+    }
+    header->size = size;
+    header->tag = tag;
+    header->magic = MEM_HEADER_MAGIC;
+    mem_track(tag, size, 1);
+    return header + 1;
+#else
     return malloc(size);
+#endif
+}
+void *mem_alloc(size_t size) {
+    return mem_alloc_tagged(size, mem_tag_current());
 }
 void *mem_realloc(void *block, size_t newsize) {
     if (!block) {
         assert(newsize);
         return mem_alloc(newsize);
-    } else {
-        if (!newsize) {
-            free(block);
-            return NULL;
-        } else {
-            return realloc(block, newsize);
-        }
+    } else if (!newsize) {
+        return mem_free(block);
+    }
+
+#ifdef MEM_TRACKING_ENABLED
+    struct MemHeader *header = (struct MemHeader *)block - 1;
+    assert(header->magic == MEM_HEADER_MAGIC && "Not a mem_alloc block!");
+    size_t oldsize = header->size;
+    header = realloc(header, sizeof(struct MemHeader) + newsize);
+    if (!header) {
+        return NULL;
     }
+    header->size = newsize;
+    mem_track(header->tag, (ptrdiff_t)newsize - (ptrdiff_t)oldsize, 0);
+    return header + 1;
+#else
+    return realloc(block, newsize);
+#endif
 }
 void *mem_free(void *block) {
     assert(block && "Possible double free?");
+#ifdef MEM_TRACKING_ENABLED
+    struct MemHeader *header = (struct MemHeader *)block - 1;
+    assert(header->magic == MEM_HEADER_MAGIC && "Not a mem_alloc block, or a double free?");
+    header->magic = 0;
+    mem_track(header->tag, -(ptrdiff_t)header->size, -1);
+    free(header);
+#else
     free(block);
+#endif
     return NULL;
 }
 void *_mem_alloc(void *dummy, size_t size) {
@@ -35,19 +184,28 @@ AllocInterface mem_alloc_interface(void) {
 struct Arena *arena_create(size_t initial_size) {
     struct Arena *arena = mem_alloc(sizeof(struct Arena) + initial_size);
     assert(arena && "Out of memory!");
+    arena->tag = mem_tag_current();
     arena->chunks = &arena->first_chunk;
     arena->chunk_off = 0;
     arena->current = arena->chunks;
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->window_peak = 0;
+    arena->resets = 0;
     arena->first_chunk.next = NULL;
     arena->first_chunk.size = initial_size;
+    arena->first_chunk.huge = false;
     return arena;
 }
+static void arena_free_chunk(struct Arena *arena, struct ArenaChunk *chunk) {
+    mem_pages_free(chunk, sizeof(struct ArenaChunk) + chunk->size, arena->tag, chunk->huge);
+}
 void arena_destroy(struct Arena *arena) {
     assert(arena);
     struct ArenaChunk *chunk = arena->chunks;
     while (chunk) {
         struct ArenaChunk *next = chunk->next;
-        if (chunk != &arena->first_chunk) mem_free(chunk);
+        if (chunk != &arena->first_chunk) arena_free_chunk(arena, chunk);
         chunk = next;
     }
     mem_free(arena);
@@ -55,9 +213,11 @@ void arena_destroy(struct Arena *arena) {
 void *arena_alloc(struct Arena *arena, size_t size) {
     struct ArenaChunk *chunk, *last;
     void *blk;
+    bool huge;
     
     size = (size / sizeof(void *) + 1) * sizeof(void *);
     if (arena->current->size - arena->chunk_off < size) {
+        arena->used += arena->current->size - arena->chunk_off;
         arena->chunk_off = 0;
 
         last = arena->current;
@@ -67,6 +227,7 @@ void *arena_alloc(struct Arena *arena, size_t size) {
                 arena->current = chunk;
                 goto found_block;
             }
+            arena->used += chunk->size;
             last = chunk;
             chunk = chunk->next;
         }
@@ -75,8 +236,12 @@ void *arena_alloc(struct Arena *arena, size_t size) {
         size_t chunk_size = last->size * 2;
         if (chunk_size < size)
             chunk_size = size * 2;
-        chunk = mem_alloc(sizeof(struct ArenaChunk) + chunk_size);
+        chunk_size = mem_pages_size(sizeof(struct ArenaChunk) + chunk_size) - sizeof(struct ArenaChunk);
+        chunk = mem_pages_alloc(sizeof(struct ArenaChunk) + chunk_size, arena->tag, &huge);
+        assert(chunk && "Out of memory!");
+        chunk->next = NULL;
         chunk->size = chunk_size;
+        chunk->huge = huge;
         last->next = chunk;
         arena->current = chunk;
     }
@@ -84,16 +249,284 @@ void *arena_alloc(struct Arena *arena, size_t size) {
 found_block:
     blk = arena->current->data + arena->chunk_off;
     arena->chunk_off += size;
+    arena->used += size;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
     return blk;
 }
 void arena_reset(struct Arena *arena) {
     arena->current = &arena->first_chunk;
     arena->chunk_off = 0;
+    if (arena->used > arena->window_peak) {
+        arena->window_peak = arena->used;
+    }
+    arena->used = 0;
+
+    // A single huge frame shouldn't pin its memory forever, but a peak that
+    // comes back every few resets is worth keeping around
+    if (++arena->resets >= ARENA_TRIM_RESETS) {
+        arena_trim(arena, arena->window_peak);
+        arena->window_peak = 0;
+        arena->resets = 0;
+    }
+}
+void arena_trim(struct Arena *arena, size_t keep) {
+    assert(arena->current == &arena->first_chunk && arena->chunk_off == 0);
+    size_t capacity = arena->first_chunk.size;
+    struct ArenaChunk *last = &arena->first_chunk;
+    while (last->next && capacity < keep) {
+        last = last->next;
+        capacity += last->size;
+    }
+
+    struct ArenaChunk *chunk = last->next;
+    last->next = NULL;
+    while (chunk) {
+        struct ArenaChunk *next = chunk->next;
+        arena_free_chunk(arena, chunk);
+        chunk = next;
+    }
+}
+size_t arena_capacity(const struct Arena *arena) {
+    size_t capacity = 0;
+    for (const struct ArenaChunk *chunk = arena->chunks; chunk; chunk = chunk->next) {
+        capacity += chunk->size;
+    }
+    return capacity;
 }
 AllocInterface arena_alloc_interface(void) {
     return (AllocInterface)arena_alloc;
 }
 
+// Two arenas per thread, one for this frame and one for the last
+static atomic_uint_fast64_t scratch_frame;
+static _Thread_local struct Arena *scratch_arenas[2];
+static _Thread_local uint_fast64_t scratch_local_frame;
+
+struct Arena *scratch_arena(void) {
+    uint_fast64_t frame = atomic_load_explicit(&scratch_frame, memory_order_relaxed);
+    struct Arena **arena = &scratch_arenas[frame & 1];
+    if (scratch_local_frame != frame) {
+        // This one was last used two frames ago, and if the thread skipped
+        // a frame the other one is just as old
+        struct Arena *other = scratch_arenas[(frame + 1) & 1];
+        if (*arena) {
+            arena_reset(*arena);
+        }
+        if (other && frame - scratch_local_frame > 1) {
+            arena_reset(other);
+        }
+        scratch_local_frame = frame;
+    }
+    if (!*arena) {
+        MEM_TAG_SCOPE(MEM_TAG_SCRATCH);
+        *arena = arena_create(SCRATCH_ARENA_SIZE);
+    }
+    return *arena;
+}
+void scratch_next_frame(void) {
+    atomic_fetch_add_explicit(&scratch_frame, 1, memory_order_relaxed);
+}
+void scratch_thread_shutdown(void) {
+    for (size_t i = 0; i < ARRAY_SIZE(scratch_arenas); i++) {
+        if (scratch_arenas[i]) {
+            arena_destroy(scratch_arenas[i]);
+            scratch_arenas[i] = NULL;
+        }
+    }
+}
+
+static size_t vm_page_size(void) {
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    return sysconf(_SC_PAGESIZE);
+#endif
+}
+static inline size_t vm_round_up(size_t size, size_t align) {
+    return (size + align - 1) / align * align;
+}
+static bool vm_commit(uint8_t *addr, size_t size) {
+#ifdef WIN32
+    return VirtualAlloc(addr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    return mprotect(addr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+static void vm_decommit(uint8_t *addr, size_t size) {
+#ifdef WIN32
+    VirtualFree(addr, size, MEM_DECOMMIT);
+#else
+    // Dropping the pages is what lowers rss, PROT_NONE makes stray accesses fault
+    madvise(addr, size, MADV_DONTNEED);
+    mprotect(addr, size, PROT_NONE);
+#endif
+}
+
+struct VmArena *vm_arena_create(size_t reserve, size_t retain) {
+    size_t page = vm_page_size();
+    reserve = vm_round_up(reserve, page);
+#ifdef WIN32
+    void *base = VirtualAlloc(NULL, reserve, MEM_RESERVE, PAGE_NOACCESS);
+    if (!base) {
+        return NULL;
+    }
+#else
+    void *base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+#endif
+
+    struct VmArena *arena = mem_alloc(sizeof(struct VmArena));
+    assert(arena && "Out of memory!");
+    *arena = (struct VmArena) {
+        .base = base,
+        .reserved = reserve,
+        .committed = 0,
+        .off = 0,
+        .retain = vm_round_up(retain, page),
+        .high_water = 0,
+        .tag = mem_tag_current(),
+    };
+    return arena;
+}
+void vm_arena_destroy(struct VmArena *arena) {
+#ifdef WIN32
+    VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+    munmap(arena->base, arena->reserved);
+#endif
+    MEM_TRACK_BYTES(arena->tag, -(ptrdiff_t)arena->committed);
+    mem_free(arena);
+}
+void *vm_arena_alloc(struct VmArena *arena, size_t size) {
+    size = vm_round_up(size ? size : 1, sizeof(void *));
+    if (size > arena->reserved - arena->off) {
+        return NULL;
+    }
+
+    size_t end = arena->off + size;
+    if (end > arena->committed) {
+        size_t commit = vm_round_up(end, VM_ARENA_COMMIT_STEP);
+        if (commit > arena->reserved) {
+            commit = arena->reserved;
+        }
+        if (!vm_commit(arena->base + arena->committed, commit - arena->committed)) {
+            return NULL;
+        }
+        MEM_TRACK_BYTES(arena->tag, commit - arena->committed);
+        arena->committed = commit;
+    }
+
+    void *blk = arena->base + arena->off;
+    arena->off = end;
+    if (end > arena->high_water) {
+        arena->high_water = end;
+    }
+    return blk;
+}
+void vm_arena_reset(struct VmArena *arena) {
+    arena->off = 0;
+    if (arena->committed > arena->retain) {
+        vm_decommit(arena->base + arena->retain, arena->committed - arena->retain);
+        MEM_TRACK_BYTES(arena->tag, -(ptrdiff_t)(arena->committed - arena->retain));
+        arena->committed = arena->retain;
+    }
+}
+AllocInterface vm_arena_alloc_interface(void) {
+    return (AllocInterface)vm_arena_alloc;
+}
+
+// -1 until it's been worked out
+static atomic_int mem_pages_mode = -1;
+static atomic_size_t mem_huge_bytes;
+
+static enum MemPageMode mem_detect_page_mode(void) {
+#if defined(LINUX) && defined(MADV_HUGEPAGE)
+    // "always [madvise] never", madvise is all we need
+    char buf[64];
+    FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (!file) {
+        return MEM_PAGES_SMALL;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[n] = '\0';
+    return strstr(buf, "[never]") ? MEM_PAGES_SMALL : MEM_PAGES_HUGE;
+#else
+    return MEM_PAGES_SMALL;
+#endif
+}
+enum MemPageMode mem_page_mode(void) {
+    int mode = atomic_load_explicit(&mem_pages_mode, memory_order_relaxed);
+    if (mode < 0) {
+        // Racing threads all come up with the same answer
+        mode = mem_detect_page_mode();
+        atomic_store_explicit(&mem_pages_mode, mode, memory_order_relaxed);
+    }
+    return mode;
+}
+enum MemPageMode mem_set_page_mode(enum MemPageMode mode) {
+    if (mode == MEM_PAGES_HUGE) {
+        mode = mem_detect_page_mode();
+    }
+    atomic_store_explicit(&mem_pages_mode, mode, memory_order_relaxed);
+    return mode;
+}
+size_t mem_huge_page_bytes(void) {
+    return atomic_load_explicit(&mem_huge_bytes, memory_order_relaxed);
+}
+size_t mem_pages_size(size_t size) {
+    if (mem_page_mode() == MEM_PAGES_HUGE && size >= MEM_HUGE_PAGE_SIZE / 2) {
+        return vm_round_up(size, MEM_HUGE_PAGE_SIZE);
+    }
+    return size;
+}
+void *mem_pages_alloc(size_t size, enum MemTag tag, bool *huge) {
+    *huge = false;
+#if defined(LINUX) && defined(MADV_HUGEPAGE)
+    if (mem_page_mode() == MEM_PAGES_HUGE && size >= MEM_HUGE_PAGE_SIZE / 2) {
+        size = vm_round_up(size, MEM_HUGE_PAGE_SIZE);
+        // mmap only lines things up to pages, so map extra and cut it down to an aligned range
+        uint8_t *map = mmap(NULL, size + MEM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED) {
+            uint8_t *block = (uint8_t *)vm_round_up((uintptr_t)map, MEM_HUGE_PAGE_SIZE);
+            if (block != map) {
+                munmap(map, block - map);
+            }
+            munmap(block + size, map + MEM_HUGE_PAGE_SIZE - block);
+            if (madvise(block, size, MADV_HUGEPAGE) == 0) {
+                atomic_fetch_add_explicit(&mem_huge_bytes, size, memory_order_relaxed);
+                MEM_TRACK_BLOCK(tag, size, 1);
+                *huge = true;
+                return block;
+            }
+            // The kernel was built without them, don't bother again
+            munmap(block, size);
+            mem_set_page_mode(MEM_PAGES_SMALL);
+        }
+    }
+#endif
+    return mem_alloc_tagged(size, tag);
+}
+void mem_pages_free(void *block, size_t size, enum MemTag tag, bool huge) {
+#if defined(LINUX) && defined(MADV_HUGEPAGE)
+    if (huge) {
+        size = vm_round_up(size, MEM_HUGE_PAGE_SIZE);
+        munmap(block, size);
+        atomic_fetch_sub_explicit(&mem_huge_bytes, size, memory_order_relaxed);
+        MEM_TRACK_BLOCK(tag, -(ptrdiff_t)size, -1);
+        return;
+    }
+#endif
+    mem_free(block);
+}
+
 struct Pool *pool_create(size_t initial_size, size_t elem_size, bool growable) {
     assert(initial_size && elem_size);
     const size_t blksz = sizeof(union PoolBlock);
@@ -104,27 +537,39 @@ struct Pool *pool_create(size_t initial_size, size_t elem_size, bool growable) {
     }
     
     struct Pool *pool = mem_alloc(sizeof(struct Pool) + initial_size * elem_size);
+    assert(pool && "Out of memory!");
+    pool->tag = mem_tag_current();
     pool->chunks = &pool->first_chunk;
     pool->elem_size = elem_size;
-    pool->biggest_chunk_size = initial_size;
+    pool->capacity = initial_size;
+    pool->live = 0;
+    pool->num_chunks = 1;
+    pool->empty_chunks = 1;
+    pool->keep_empty = POOL_KEEP_EMPTY;
     pool->growable = growable;
     pool->free_chunks = pool->chunks;
     pool->free_chunks_end = pool->free_chunks;
 
+    pool->first_chunk.prev = NULL;
     pool->first_chunk.next = NULL;
     pool->first_chunk.last_free = NULL;
     pool->first_chunk.next_free = NULL;
     pool->first_chunk.free_list = NULL;
     pool->first_chunk.initial_free_size = 0;
     pool->first_chunk.size = initial_size;
+    pool->first_chunk.live = 0;
+    pool->first_chunk.huge = false;
 
     return pool;
 }
+static void pool_free_chunk(struct Pool *pool, struct PoolChunk *chunk) {
+    mem_pages_free(chunk, sizeof(struct PoolChunk) + chunk->size * pool->elem_size, pool->tag, chunk->huge);
+}
 void pool_destroy(struct Pool *pool) {
     struct PoolChunk *chunk = pool->chunks;
     while (chunk) {
         struct PoolChunk *next = chunk->next;
-        if (chunk != &pool->first_chunk) mem_free(chunk);
+        if (chunk != &pool->first_chunk) pool_free_chunk(pool, chunk);
         chunk = next;
     }
     mem_free(pool);
@@ -144,33 +589,43 @@ static void pool_unfree_chunk(struct Pool *pool, struct PoolChunk *chunk) {
 void *pool_alloc(struct Pool *pool) {
     struct PoolChunk *chunk = pool->free_chunks;
     if (!chunk && pool->growable) {
-        // Allocate a new chunk
-        pool->biggest_chunk_size *= 2;
-        chunk = mem_alloc(sizeof(struct PoolChunk) + pool->biggest_chunk_size * pool->elem_size);
+        // Allocate a new chunk, doubling the pool
+        size_t bytes = mem_pages_size(sizeof(struct PoolChunk) + pool->capacity * pool->elem_size);
+        size_t size = (bytes - sizeof(struct PoolChunk)) / pool->elem_size;
+        bool huge;
+        chunk = mem_pages_alloc(bytes, pool->tag, &huge);
+        assert(chunk && "Out of memory!");
+        chunk->huge = huge;
+        chunk->prev = NULL;
         chunk->next = pool->chunks;
-        pool->chunks->next = chunk->next;
-        chunk->last_free = NULL; // Add to start of list (lots of free blocks)
-        chunk->next_free = pool->free_chunks;
-        if (pool->free_chunks) {
-            pool->free_chunks->last_free = chunk;
-        }
-        if (!pool->free_chunks) {
-            pool->free_chunks = chunk;
-            pool->free_chunks_end = chunk;
-        } else if (pool->free_chunks_end == pool->free_chunks) {
-            pool->free_chunks_end = pool->free_chunks;
-            pool->free_chunks = chunk;
-        } else {
-            pool->free_chunks = chunk;
-        }
+        pool->chunks->prev = chunk;
+        pool->chunks = chunk;
+        chunk->free_list = NULL;
+        chunk->initial_free_size = 0;
+        chunk->size = size;
+        chunk->live = 0;
+        pool->capacity += size;
+        pool->num_chunks++;
+        pool->empty_chunks++;
+        // Only get here when no chunk has free blocks
+        chunk->last_free = NULL;
+        chunk->next_free = NULL;
+        pool->free_chunks = chunk;
+        pool->free_chunks_end = chunk;
     } else if (!chunk && !pool->growable) {
         return NULL;
     }
 
+    if (chunk->live++ == 0) {
+        pool->empty_chunks--;
+    }
+    pool->live++;
+
     union PoolBlock *block;
     if (chunk->initial_free_size < chunk->size) {
         block = (union PoolBlock *)(chunk->data + pool->elem_size * chunk->initial_free_size++);
-        if (chunk->initial_free_size == chunk->size) {
+        // Blocks freed before the fresh ones ran out are still on the free list
+        if (chunk->initial_free_size == chunk->size && !chunk->free_list) {
             pool_unfree_chunk(pool, chunk);
         }
         block->alloced.chunk = chunk;
@@ -185,6 +640,28 @@ void *pool_alloc(struct Pool *pool) {
         return block + 1;
     }
 }
+// The chunk has no live blocks left, give it back or start it over fresh
+static void pool_chunk_emptied(struct Pool *pool, struct PoolChunk *chunk) {
+    if (chunk != &pool->first_chunk && pool->empty_chunks > pool->keep_empty) {
+        pool_unfree_chunk(pool, chunk);
+        if (chunk->prev) {
+            chunk->prev->next = chunk->next;
+        } else {
+            pool->chunks = chunk->next;
+        }
+        if (chunk->next) {
+            chunk->next->prev = chunk->prev;
+        }
+        pool->capacity -= chunk->size;
+        pool->num_chunks--;
+        pool->empty_chunks--;
+        pool_free_chunk(pool, chunk);
+    } else {
+        // Handing out blocks in order again beats the scattered free list
+        chunk->free_list = NULL;
+        chunk->initial_free_size = 0;
+    }
+}
 void *pool_free(struct Pool *pool, void *_block) {
     union PoolBlock *block = (union PoolBlock *)_block - 1;
     struct PoolChunk *chunk = block->alloced.chunk;
@@ -200,11 +677,263 @@ void *pool_free(struct Pool *pool, void *_block) {
             pool->free_chunks_end->next_free = chunk;
             pool->free_chunks_end = chunk;
         } else {
+            chunk->last_free = NULL;
             pool->free_chunks = chunk;
             pool->free_chunks_end = chunk;
         }
         chunk->next_free = NULL;
     }
 
+    pool->live--;
+    if (--chunk->live == 0) {
+        pool->empty_chunks++;
+        pool_chunk_emptied(pool, chunk);
+    }
+    return NULL;
+}
+
+struct PoolStats pool_get_stats(const struct Pool *pool) {
+    size_t empty_capacity = 0;
+    for (const struct PoolChunk *chunk = pool->chunks; chunk; chunk = chunk->next) {
+        if (!chunk->live) {
+            empty_capacity += chunk->size;
+        }
+    }
+    size_t free = pool->capacity - pool->live;
+    return (struct PoolStats) {
+        .chunks = pool->num_chunks,
+        .empty_chunks = pool->empty_chunks,
+        .capacity = pool->capacity,
+        .live = pool->live,
+        .occupancy = (float)pool->live / (float)pool->capacity,
+        .fragmentation = free ? (float)(free - empty_capacity) / (float)free : 0.0f,
+    };
+}
+void pool_print_stats(const char *name, const struct Pool *pool) {
+    struct PoolStats stats = pool_get_stats(pool);
+    printf("pool %s: %zu/%zu live (%.1f%%), %zu chunks (%zu empty), %.1f%% of free space fragmented, %zu KiB\n",
+            name, stats.live, stats.capacity, stats.occupancy * 100.0f,
+            stats.chunks, stats.empty_chunks, stats.fragmentation * 100.0f,
+            stats.capacity * pool->elem_size / 1024);
+}
+
+_Static_assert(MEM_MAX_THREADS <= 64, "Thread indexes are one bit each of a 64 bit mask");
+// Bit i is set while some thread has index i
+static atomic_uint_fast64_t mem_thread_indexes;
+static _Thread_local uint32_t mem_thread_index_plus_one;
+
+uint32_t mem_thread_index(void) {
+    if (!mem_thread_index_plus_one) {
+        uint_fast64_t used = atomic_load_explicit(&mem_thread_indexes, memory_order_relaxed);
+        uint32_t i;
+        do {
+            i = 0;
+            while (i < MEM_MAX_THREADS && (used & (UINT64_C(1) << i))) {
+                i++;
+            }
+            if (i == MEM_MAX_THREADS) {
+                // Every SharedPool has a slot per index, going on would corrupt them
+                printf("mem error: more than %d threads at once have a thread index\n", MEM_MAX_THREADS);
+                fflush(stdout);
+                abort();
+            }
+        } while (!atomic_compare_exchange_weak_explicit(&mem_thread_indexes, &used, used | (UINT64_C(1) << i),
+                                                        memory_order_acquire, memory_order_relaxed));
+        mem_thread_index_plus_one = i + 1;
+    }
+    return mem_thread_index_plus_one - 1;
+}
+void mem_thread_shutdown(void) {
+    if (mem_thread_index_plus_one) {
+        atomic_fetch_and_explicit(&mem_thread_indexes, ~(UINT64_C(1) << (mem_thread_index_plus_one - 1)),
+                                    memory_order_release);
+        mem_thread_index_plus_one = 0;
+    }
+}
+
+struct SharedPool *shared_pool_create(size_t chunk_size, size_t elem_size) {
+    assert(chunk_size && elem_size);
+    const size_t blksz = sizeof(union SharedPoolBlock);
+    struct SharedPool *pool = mem_alloc(sizeof(struct SharedPool));
+    assert(pool && "Out of memory!");
+    // Room for the chunk pointer in front of every element
+    pool->elem_size = (elem_size + blksz - 1) / blksz * blksz + blksz;
+    pool->chunk_size = (mem_pages_size(sizeof(struct SharedPoolChunk) + chunk_size * pool->elem_size)
+                        - sizeof(struct SharedPoolChunk)) / pool->elem_size;
+    pool->tag = mem_tag_current();
+    atomic_init(&pool->num_chunks, 0);
+    atomic_init(&pool->orphans, 0);
+    memset(pool->threads, 0, sizeof(pool->threads));
+    return pool;
+}
+static void shared_pool_free_chunk(struct SharedPool *pool, struct SharedPoolChunk *chunk) {
+    mem_pages_free(chunk, sizeof(struct SharedPoolChunk) + chunk->size * pool->elem_size, pool->tag, chunk->huge);
+}
+void shared_pool_destroy(struct SharedPool *pool) {
+    // Every chunk is either owned by a thread or an orphan
+    for (size_t i = 0; i < MEM_MAX_THREADS; i++) {
+        struct SharedPoolChunk *chunk = pool->threads[i].owned;
+        while (chunk) {
+            struct SharedPoolChunk *next = chunk->next_owned;
+            shared_pool_free_chunk(pool, chunk);
+            chunk = next;
+        }
+    }
+    struct SharedPoolChunk *chunk = (struct SharedPoolChunk *)(uintptr_t)
+        (atomic_load(&pool->orphans) & SHARED_POOL_PTR_MASK);
+    while (chunk) {
+        struct SharedPoolChunk *next = atomic_load(&chunk->next_orphan);
+        shared_pool_free_chunk(pool, chunk);
+        chunk = next;
+    }
+    mem_free(pool);
+}
+
+static void shared_pool_push_orphan(struct SharedPool *pool, struct SharedPoolChunk *chunk) {
+    uint_fast64_t head = atomic_load_explicit(&pool->orphans, memory_order_relaxed), next;
+    chunk->orphaned = true;
+    do {
+        atomic_store_explicit(&chunk->next_orphan,
+                                (struct SharedPoolChunk *)(uintptr_t)(head & SHARED_POOL_PTR_MASK),
+                                memory_order_relaxed);
+        next = (((head >> SHARED_POOL_TAG_SHIFT) + 1) << SHARED_POOL_TAG_SHIFT) | (uintptr_t)chunk;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->orphans, &head, next,
+                                                    memory_order_release, memory_order_relaxed));
+}
+static struct SharedPoolChunk *shared_pool_pop_orphan(struct SharedPool *pool) {
+    uint_fast64_t head = atomic_load_explicit(&pool->orphans, memory_order_acquire), next;
+    struct SharedPoolChunk *chunk;
+    do {
+        chunk = (struct SharedPoolChunk *)(uintptr_t)(head & SHARED_POOL_PTR_MASK);
+        if (!chunk) {
+            return NULL;
+        }
+        // Orphans are never unmapped before the pool is (trim skips them), so
+        // this is fine to read even if someone else popped it first and
+        // trimmed it, the tag makes the exchange fail then
+        struct SharedPoolChunk *after = atomic_load_explicit(&chunk->next_orphan, memory_order_relaxed);
+        next = (((head >> SHARED_POOL_TAG_SHIFT) + 1) << SHARED_POOL_TAG_SHIFT) | (uintptr_t)after;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->orphans, &head, next,
+                                                    memory_order_acquire, memory_order_acquire));
+    return chunk;
+}
+
+// Only the owner can take blocks out of a chunk
+static union SharedPoolBlock *shared_pool_chunk_take(struct SharedPool *pool, struct SharedPoolChunk *chunk) {
+    union SharedPoolBlock *block = chunk->local_free;
+    if (block) {
+        chunk->local_free = block->next;
+    } else if (chunk->bump < chunk->size) {
+        block = (union SharedPoolBlock *)(chunk->data + pool->elem_size * chunk->bump++);
+    } else {
+        block = atomic_exchange_explicit(&chunk->remote_free, NULL, memory_order_acquire);
+        if (!block) {
+            return NULL;
+        }
+        chunk->local_free = block->next;
+    }
+    atomic_fetch_add_explicit(&chunk->live, 1, memory_order_relaxed);
+    block->chunk = chunk;
+    return block;
+}
+static struct SharedPoolChunk *shared_pool_new_chunk(struct SharedPool *pool) {
+    bool huge;
+    struct SharedPoolChunk *chunk = mem_pages_alloc(sizeof(struct SharedPoolChunk) + pool->chunk_size * pool->elem_size,
+                                                    pool->tag, &huge);
+    assert(chunk && "Out of memory!");
+    chunk->huge = huge;
+    chunk->orphaned = false;
+    chunk->next_owned = NULL;
+    atomic_init(&chunk->next_orphan, NULL);
+    chunk->local_free = NULL;
+    chunk->bump = 0;
+    chunk->size = pool->chunk_size;
+    atomic_init(&chunk->remote_free, NULL);
+    atomic_init(&chunk->live, 0);
+    atomic_fetch_add_explicit(&pool->num_chunks, 1, memory_order_relaxed);
+    return chunk;
+}
+void *shared_pool_alloc(struct SharedPool *pool) {
+    uint32_t me = mem_thread_index();
+    struct SharedPoolThread *thread = &pool->threads[me];
+    union SharedPoolBlock *block = NULL;
+
+    if (thread->current) {
+        block = shared_pool_chunk_take(pool, thread->current);
+    }
+    // Our other chunks might have gotten blocks back since
+    for (struct SharedPoolChunk *chunk = thread->owned; chunk && !block; chunk = chunk->next_owned) {
+        if (chunk != thread->current && (block = shared_pool_chunk_take(pool, chunk))) {
+            thread->current = chunk;
+        }
+    }
+    // Adopted orphans can be full, they still join our chunks for later
+    while (!block) {
+        struct SharedPoolChunk *chunk = shared_pool_pop_orphan(pool);
+        if (!chunk) {
+            chunk = shared_pool_new_chunk(pool);
+        }
+        atomic_store_explicit(&chunk->owner, me, memory_order_relaxed);
+        chunk->next_owned = thread->owned;
+        thread->owned = chunk;
+        thread->current = chunk;
+        block = shared_pool_chunk_take(pool, chunk);
+    }
+    return block + 1;
+}
+void *shared_pool_free(struct SharedPool *pool, void *_block) {
+    union SharedPoolBlock *block = (union SharedPoolBlock *)_block - 1;
+    struct SharedPoolChunk *chunk = block->chunk;
+
+    // Only we can make ourselves the owner, so this can't change under us
+    if (atomic_load_explicit(&chunk->owner, memory_order_relaxed) == mem_thread_index()) {
+        block->next = chunk->local_free;
+        chunk->local_free = block;
+        atomic_fetch_sub_explicit(&chunk->live, 1, memory_order_relaxed);
+    } else {
+        block->next = atomic_load_explicit(&chunk->remote_free, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&chunk->remote_free, &block->next, block,
+                                                        memory_order_release, memory_order_relaxed));
+        // Last touch of the chunk, the owner is free to release it after this
+        atomic_fetch_sub_explicit(&chunk->live, 1, memory_order_release);
+    }
     return NULL;
 }
+void shared_pool_thread_release(struct SharedPool *pool) {
+    struct SharedPoolThread *thread = &pool->threads[mem_thread_index()];
+    struct SharedPoolChunk *chunk = thread->owned;
+    while (chunk) {
+        struct SharedPoolChunk *next = chunk->next_owned;
+        atomic_store_explicit(&chunk->owner, MEM_MAX_THREADS, memory_order_relaxed);
+        shared_pool_push_orphan(pool, chunk);
+        chunk = next;
+    }
+    thread->owned = NULL;
+    thread->current = NULL;
+}
+size_t shared_pool_thread_trim(struct SharedPool *pool, size_t keep_empty) {
+    struct SharedPoolThread *thread = &pool->threads[mem_thread_index()];
+    struct SharedPoolChunk **link = &thread->owned;
+    size_t empty = 0, freed = 0;
+    while (*link) {
+        struct SharedPoolChunk *chunk = *link;
+        if (chunk == thread->current || atomic_load_explicit(&chunk->live, memory_order_acquire)) {
+            link = &chunk->next_owned;
+            continue;
+        }
+
+        if (empty++ < keep_empty || chunk->orphaned) {
+            // Start it over, every block it handed out is back
+            chunk->local_free = NULL;
+            chunk->bump = 0;
+            atomic_store_explicit(&chunk->remote_free, NULL, memory_order_relaxed);
+            link = &chunk->next_owned;
+        } else {
+            *link = chunk->next_owned;
+            atomic_fetch_sub_explicit(&pool->num_chunks, 1, memory_order_relaxed);
+            shared_pool_free_chunk(pool, chunk);
+            freed++;
+        }
+    }
+    return freed;
+}
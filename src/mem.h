@@ -1,23 +1,83 @@
 #ifndef _MEM_H
 #define _MEM_H
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define ARENA_TRIM_RESETS 64
+#define SCRATCH_ARENA_SIZE (256 * 1024)
+#define POOL_KEEP_EMPTY 1
+// Threads that can touch a SharedPool at once, indexes are reused after
+// mem_thread_shutdown
+#define MEM_MAX_THREADS 64
+// Arena, pool and shared pool chunks at least half this big get their own
+// aligned mapping backed by transparent huge pages when they're available
+#define MEM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
 
 typedef void *(*AllocInterface)(void *allocator, size_t size);
 
+// Byte and allocation counts per subsystem, compiled in for debug builds or
+// release builds with -DMEM_TRACKING
+#if defined(DEBUG) || defined(MEM_TRACKING)
+# define MEM_TRACKING_ENABLED
+#endif
+enum MemTag {
+    MEM_TAG_GENERAL,
+    MEM_TAG_WORLD,
+    MEM_TAG_SAVE,
+    MEM_TAG_RENDER,
+    MEM_TAG_PROFILE,
+    MEM_TAG_SCRATCH,
+    MEM_TAG_SLAB,
+    MEM_TAG_CACHE,
+    MEM_TAG_COUNT,
+};
+extern const char *const mem_tag_names[MEM_TAG_COUNT];
+
+// What big chunks are backed with
+enum MemPageMode {
+    // mem_alloc like everything else
+    MEM_PAGES_SMALL,
+    // MEM_HUGE_PAGE_SIZE aligned mmap with MADV_HUGEPAGE
+    MEM_PAGES_HUGE,
+};
+
 struct ArenaChunk {
     struct ArenaChunk *next;
+    // Came from mem_pages_alloc as a huge page mapping
+    bool huge;
     size_t size;
     uint8_t data[];
 };
 struct Arena {
     struct ArenaChunk *chunks, *current;
     size_t chunk_off;
+    // Bytes taken since the last reset (counting chunk tails that got skipped),
+    // and the most that has ever been taken
+    size_t used, high_water;
+    // Most taken over the last few resets, that's what a trim keeps room for
+    size_t window_peak;
+    uint32_t resets;
+    enum MemTag tag;
     struct ArenaChunk first_chunk;
 };
+// Position to rewind an arena back to, everything allocated after it is freed
+struct ArenaMark {
+    struct ArenaChunk *chunk;
+    size_t chunk_off, used;
+};
+
+// One contiguous reserved address range, pages get committed as it grows
+struct VmArena {
+    uint8_t *base;
+    size_t reserved, committed, off;
+    // Committed bytes a reset leaves alone, the rest goes back to the os
+    size_t retain;
+    size_t high_water;
+    enum MemTag tag;
+};
 
 struct PoolChunk;
 union PoolBlock {
@@ -29,10 +89,11 @@ union PoolBlock {
     } alloced;
 };
 struct PoolChunk {
-    struct PoolChunk *next, *last_free, *next_free;
+    struct PoolChunk *prev, *next, *last_free, *next_free;
     union PoolBlock *free_list;
     size_t initial_free_size;
-    size_t size;
+    bool huge;
+    size_t size, live;
     uint8_t data[];
 };
 struct Pool {
@@ -42,26 +103,212 @@ struct Pool {
     struct PoolChunk *free_chunks, *free_chunks_end;
     bool growable;
     size_t elem_size;
-    size_t biggest_chunk_size;
+    // In elements, new chunks are as big as everything else put together
+    size_t capacity, live;
+    size_t num_chunks, empty_chunks;
+    // Chunks that go completely empty are freed once there's more than
+    // this many, the rest are kept so churn doesn't hit malloc every time
+    size_t keep_empty;
+    enum MemTag tag;
     struct PoolChunk first_chunk;
 };
+struct PoolStats {
+    size_t chunks, empty_chunks;
+    size_t capacity, live;
+    // Live elements over capacity
+    float occupancy;
+    // How much of the free space is stuck in chunks that are partly used
+    float fragmentation;
+};
+
+// Pool any thread can allocate from and free to. Every chunk is owned by
+// one thread which allocates from it without atomics. Frees from the owner
+// go on its local free list, frees from anyone else go on the chunk's
+// remote list (a lock free stack the owner takes all at once). Chunks of
+// threads that are done are put on an orphan stack for others to adopt.
+union SharedPoolBlock {
+    struct SharedPoolChunk *chunk;
+    union SharedPoolBlock *next;
+};
+struct SharedPoolChunk {
+    // Chunks of the same owner
+    struct SharedPoolChunk *next_owned;
+    _Atomic(struct SharedPoolChunk *) next_orphan;
+    // MEM_MAX_THREADS while it's an orphan
+    atomic_uint owner;
+    bool huge;
+    // Has been on the orphan stack, so a pop might still read it and it's
+    // only unmapped with the pool
+    bool orphaned;
+    // Only touched by the owner
+    union SharedPoolBlock *local_free;
+    size_t bump, size;
+    _Atomic(union SharedPoolBlock *) remote_free;
+    // Remote frees drop it after pushing, so once it reads 0 nobody touches the chunk
+    atomic_size_t live;
+    uint8_t data[];
+};
+struct SharedPoolThread {
+    struct SharedPoolChunk *current, *owned;
+};
+struct SharedPool {
+    size_t elem_size, chunk_size;
+    enum MemTag tag;
+    atomic_size_t num_chunks;
+    // Tagged pointer, the top 16 bits count pushes so a pop can't be fooled
+    // by the same chunk being popped and pushed back in between (ABA)
+    atomic_uint_fast64_t orphans;
+    struct SharedPoolThread threads[MEM_MAX_THREADS];
+};
+
+#ifdef MEM_TRACKING_ENABLED
+struct MemTagScope {
+    enum MemTag prev;
+};
+// Tag that mem_alloc charges on this thread
+extern _Thread_local enum MemTag mem_current_tag;
+static inline enum MemTag mem_tag_current(void) {
+    return mem_current_tag;
+}
+static inline struct MemTagScope mem_tag_push(enum MemTag tag) {
+    struct MemTagScope scope = (struct MemTagScope) { .prev = mem_current_tag };
+    mem_current_tag = tag;
+    return scope;
+}
+static inline void mem_tag_pop(struct MemTagScope *scope) {
+    mem_current_tag = scope->prev;
+}
+// Charges every mem_alloc for the rest of the enclosing scope to tag
+# define MEM_TAG_SCOPE(tag) \
+    struct MemTagScope _mem_tag_scope __attribute__((cleanup(mem_tag_pop))) = mem_tag_push(tag)
+
+// Prints an error whenever the tag's live bytes go over budget (0 for none)
+void mem_set_budget(enum MemTag tag, size_t bytes);
+// Call once per frame, keeps track of allocations per frame
+void mem_track_next_frame(void);
+size_t mem_tag_live_bytes(enum MemTag tag);
+void mem_print_stats(void);
+// Call at exit once everything should be freed, returns false if something wasn't
+bool mem_report_leaks(void);
+#else
+static inline enum MemTag mem_tag_current(void) {
+    return MEM_TAG_GENERAL;
+}
+# define MEM_TAG_SCOPE(tag) (void)0
+static inline void mem_set_budget(enum MemTag tag, size_t bytes) {}
+static inline void mem_track_next_frame(void) {}
+static inline size_t mem_tag_live_bytes(enum MemTag tag) {
+    return 0;
+}
+static inline void mem_print_stats(void) {}
+static inline bool mem_report_leaks(void) {
+    return true;
+}
+#endif
 
 void *mem_alloc(size_t size);
+void *mem_alloc_tagged(size_t size, enum MemTag tag);
+// Keeps the tag the block was allocated with
 void *mem_realloc(void *block, size_t newsize);
 void *mem_free(void *block);
 AllocInterface mem_alloc_interface(void);
 
+// Worked out the first time it's asked for: huge if the os has transparent
+// huge pages turned on, small otherwise
+enum MemPageMode mem_page_mode(void);
+// Asking for huge pages where they aren't supported leaves them off,
+// returns the mode that's in use now
+enum MemPageMode mem_set_page_mode(enum MemPageMode mode);
+// Bytes currently mapped with huge pages asked for
+size_t mem_huge_page_bytes(void);
+// What mem_pages_alloc really hands out for size, callers should use the slack
+size_t mem_pages_size(size_t size);
+// Storage for big chunks, *huge says how it has to be given back
+void *mem_pages_alloc(size_t size, enum MemTag tag, bool *huge);
+void mem_pages_free(void *block, size_t size, enum MemTag tag, bool huge);
+
 // Will never return a NULL arena
 struct Arena *arena_create(size_t initial_size);
 void arena_destroy(struct Arena *arena);
 void *arena_alloc(struct Arena *arena, size_t size);
+// Every ARENA_TRIM_RESETS resets the overflow chunks that weren't needed are freed
 void arena_reset(struct Arena *arena);
+// Frees overflow chunks past the first keep bytes, only call it right after a reset
+void arena_trim(struct Arena *arena, size_t keep);
+size_t arena_capacity(const struct Arena *arena);
 AllocInterface arena_alloc_interface(void);
+static inline struct ArenaMark arena_mark(const struct Arena *arena) {
+    return (struct ArenaMark) {
+        .chunk = arena->current,
+        .chunk_off = arena->chunk_off,
+        .used = arena->used,
+    };
+}
+static inline void arena_rewind(struct Arena *arena, struct ArenaMark mark) {
+    arena->current = mark.chunk;
+    arena->chunk_off = mark.chunk_off;
+    arena->used = mark.used;
+}
 
-// Will never return NULL pool
+// Per thread scratch memory. Allocations stay valid until the end of the
+// next frame, the arena it came from is reset the frame after that.
+// Use arena_mark/arena_rewind for anything that can be freed sooner.
+struct Arena *scratch_arena(void);
+// Call once per frame from the main loop
+void scratch_next_frame(void);
+// Frees the calling thread's scratch arenas, call it before the thread exits
+void scratch_thread_shutdown(void);
+
+// Reserves reserve bytes of address space without using any memory.
+// Returns NULL if the os won't hand out that much address space
+struct VmArena *vm_arena_create(size_t reserve, size_t retain);
+void vm_arena_destroy(struct VmArena *arena);
+// Returns NULL once the reserved range is used up
+void *vm_arena_alloc(struct VmArena *arena, size_t size);
+// Rewinds to the start and decommits everything past arena->retain
+void vm_arena_reset(struct VmArena *arena);
+AllocInterface vm_arena_alloc_interface(void);
+static inline size_t vm_arena_mark(const struct VmArena *arena) {
+    return arena->off;
+}
+static inline void vm_arena_rewind(struct VmArena *arena, size_t mark) {
+    arena->off = mark;
+}
+
+// Will never return NULL pool. The first chunk lives with the pool, chunks
+// it grows by are rounded up to use huge pages when they're big enough
 struct Pool *pool_create(size_t initial_size, size_t elem_size, bool growable);
 void pool_destroy(struct Pool *pool);
 void *pool_alloc(struct Pool *pool);
 void *pool_free(struct Pool *pool, void *block);
+static inline void pool_set_keep_empty(struct Pool *pool, size_t chunks) {
+    pool->keep_empty = chunks;
+}
+struct PoolStats pool_get_stats(const struct Pool *pool);
+void pool_print_stats(const char *name, const struct Pool *pool);
+
+// Small index for the calling thread, handed out the first time it's asked
+// for. Aborts if MEM_MAX_THREADS threads already have one.
+uint32_t mem_thread_index(void);
+// Gives the calling thread's index back, call it last before the thread
+// exits. Whichever thread gets the index next inherits any SharedPool
+// chunks it didn't release.
+void mem_thread_shutdown(void);
+// Will never return NULL pool, chunk_size is in elements (and gets rounded
+// up to fill huge pages)
+struct SharedPool *shared_pool_create(size_t chunk_size, size_t elem_size);
+// Every thread has to be done with the pool
+void shared_pool_destroy(struct SharedPool *pool);
+void *shared_pool_alloc(struct SharedPool *pool);
+// Safe from any thread, whichever thread allocated the block
+void *shared_pool_free(struct SharedPool *pool, void *block);
+// Gives the calling thread's chunks to other threads, call it before the thread exits
+void shared_pool_thread_release(struct SharedPool *pool);
+// Frees the calling thread's empty chunks past the first keep_empty, returns
+// how many. Chunks that were ever orphans are only started over, not freed.
+size_t shared_pool_thread_trim(struct SharedPool *pool, size_t keep_empty);
+static inline size_t shared_pool_capacity(const struct SharedPool *pool) {
+    return atomic_load_explicit(&pool->num_chunks, memory_order_relaxed) * pool->chunk_size;
+}
 
 #endif
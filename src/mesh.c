@@ -0,0 +1,184 @@
+#include <assert.h>
+#include <stdbool.h>
+
+#include "mesh.h"
+#include "padded.h"
+#include "profile.h"
+
+// Neighbours in the padded copy are a fixed offset away
+#define MESH_OFS(x, y, z) ((x) + (z) * PADDED_SECTION + (y) * PADDED_SECTION * PADDED_SECTION)
+
+struct MeshCorner {
+    // Offsets from the block to the two sides and the corner in front of the
+    // face that touch this vertex
+    int side1, side2, corner;
+    uint8_t pos[3];
+    uint8_t uv[2];
+};
+struct MeshFace {
+    // Offset to the block the face looks at
+    int normal;
+    // Counter clockwise seen from the outside
+    struct MeshCorner corners[4];
+};
+static const struct MeshFace mesh_faces[6] = {
+    { // +x
+        .normal = MESH_OFS( 1,  0,  0),
+        .corners = {
+            { MESH_OFS( 1, -1,  0), MESH_OFS( 1,  0, -1), MESH_OFS( 1, -1, -1), { 1, 0, 0 }, { 0, 1 } },
+            { MESH_OFS( 1,  1,  0), MESH_OFS( 1,  0, -1), MESH_OFS( 1,  1, -1), { 1, 1, 0 }, { 0, 0 } },
+            { MESH_OFS( 1,  1,  0), MESH_OFS( 1,  0,  1), MESH_OFS( 1,  1,  1), { 1, 1, 1 }, { 1, 0 } },
+            { MESH_OFS( 1, -1,  0), MESH_OFS( 1,  0,  1), MESH_OFS( 1, -1,  1), { 1, 0, 1 }, { 1, 1 } },
+        },
+    },
+    { // -x
+        .normal = MESH_OFS(-1,  0,  0),
+        .corners = {
+            { MESH_OFS(-1,  0, -1), MESH_OFS(-1, -1,  0), MESH_OFS(-1, -1, -1), { 0, 0, 0 }, { 0, 1 } },
+            { MESH_OFS(-1,  0,  1), MESH_OFS(-1, -1,  0), MESH_OFS(-1, -1,  1), { 0, 0, 1 }, { 1, 1 } },
+            { MESH_OFS(-1,  0,  1), MESH_OFS(-1,  1,  0), MESH_OFS(-1,  1,  1), { 0, 1, 1 }, { 1, 0 } },
+            { MESH_OFS(-1,  0, -1), MESH_OFS(-1,  1,  0), MESH_OFS(-1,  1, -1), { 0, 1, 0 }, { 0, 0 } },
+        },
+    },
+    { // +y
+        .normal = MESH_OFS( 0,  1,  0),
+        .corners = {
+            { MESH_OFS( 0,  1, -1), MESH_OFS(-1,  1,  0), MESH_OFS(-1,  1, -1), { 0, 1, 0 }, { 0, 0 } },
+            { MESH_OFS( 0,  1,  1), MESH_OFS(-1,  1,  0), MESH_OFS(-1,  1,  1), { 0, 1, 1 }, { 0, 1 } },
+            { MESH_OFS( 0,  1,  1), MESH_OFS( 1,  1,  0), MESH_OFS( 1,  1,  1), { 1, 1, 1 }, { 1, 1 } },
+            { MESH_OFS( 0,  1, -1), MESH_OFS( 1,  1,  0), MESH_OFS( 1,  1, -1), { 1, 1, 0 }, { 1, 0 } },
+        },
+    },
+    { // -y
+        .normal = MESH_OFS( 0, -1,  0),
+        .corners = {
+            { MESH_OFS(-1, -1,  0), MESH_OFS( 0, -1, -1), MESH_OFS(-1, -1, -1), { 0, 0, 0 }, { 0, 0 } },
+            { MESH_OFS( 1, -1,  0), MESH_OFS( 0, -1, -1), MESH_OFS( 1, -1, -1), { 1, 0, 0 }, { 1, 0 } },
+            { MESH_OFS( 1, -1,  0), MESH_OFS( 0, -1,  1), MESH_OFS( 1, -1,  1), { 1, 0, 1 }, { 1, 1 } },
+            { MESH_OFS(-1, -1,  0), MESH_OFS( 0, -1,  1), MESH_OFS(-1, -1,  1), { 0, 0, 1 }, { 0, 1 } },
+        },
+    },
+    { // +z
+        .normal = MESH_OFS( 0,  0,  1),
+        .corners = {
+            { MESH_OFS(-1,  0,  1), MESH_OFS( 0, -1,  1), MESH_OFS(-1, -1,  1), { 0, 0, 1 }, { 0, 1 } },
+            { MESH_OFS( 1,  0,  1), MESH_OFS( 0, -1,  1), MESH_OFS( 1, -1,  1), { 1, 0, 1 }, { 1, 1 } },
+            { MESH_OFS( 1,  0,  1), MESH_OFS( 0,  1,  1), MESH_OFS( 1,  1,  1), { 1, 1, 1 }, { 1, 0 } },
+            { MESH_OFS(-1,  0,  1), MESH_OFS( 0,  1,  1), MESH_OFS(-1,  1,  1), { 0, 1, 1 }, { 0, 0 } },
+        },
+    },
+    { // -z
+        .normal = MESH_OFS( 0,  0, -1),
+        .corners = {
+            { MESH_OFS( 0, -1, -1), MESH_OFS(-1,  0, -1), MESH_OFS(-1, -1, -1), { 0, 0, 0 }, { 0, 1 } },
+            { MESH_OFS( 0,  1, -1), MESH_OFS(-1,  0, -1), MESH_OFS(-1,  1, -1), { 0, 1, 0 }, { 0, 0 } },
+            { MESH_OFS( 0,  1, -1), MESH_OFS( 1,  0, -1), MESH_OFS( 1,  1, -1), { 1, 1, 0 }, { 1, 0 } },
+            { MESH_OFS( 0, -1, -1), MESH_OFS( 1,  0, -1), MESH_OFS( 1, -1, -1), { 1, 0, 0 }, { 1, 1 } },
+        },
+    },
+};
+
+static void mesh_emit_face(const struct PaddedBlocks *pad, const struct MeshFace *face, int p,
+                            int x, int y, int z, uint8_t layer, struct SectionMesh *mesh) {
+    const uint8_t face_light = pad->light[p + face->normal];
+    struct Vertex *verts = &mesh->vertexes[mesh->num_vertexes];
+    uint8_t ao[4];
+
+    for (int c = 0; c < 4; c++) {
+        const struct MeshCorner *corner = &face->corners[c];
+        const bool side1 = pad->flags[p + corner->side1] & PADDED_OPAQUE;
+        const bool side2 = pad->flags[p + corner->side2] & PADDED_OPAQUE;
+        // Light can't get round to a corner hidden behind both sides
+        const bool hidden = (pad->flags[p + corner->corner] & PADDED_OPAQUE) || (side1 && side2);
+        // Opaque blocks have no light of their own, they'd make every corner
+        // next to a wall pitch black, so they count as the face's light
+        const uint8_t l1 = side1 ? face_light : pad->light[p + corner->side1];
+        const uint8_t l2 = side2 ? face_light : pad->light[p + corner->side2];
+        const uint8_t lc = hidden ? face_light : pad->light[p + corner->corner];
+
+        ao[c] = side1 && side2 ? 0 : 3 - (side1 + side2 + hidden);
+        verts[c] = (struct Vertex) {
+            .pos = { (float)(x + corner->pos[0]), (float)(y + corner->pos[1]), (float)(z + corner->pos[2]), },
+            .uv = { corner->uv[0], corner->uv[1], },
+            .light = {
+                light_sky(face_light) + light_sky(l1) + light_sky(l2) + light_sky(lc),
+                light_block(face_light) + light_block(l1) + light_block(l2) + light_block(lc),
+                ao[c],
+            },
+            .layer = layer,
+        };
+    }
+
+    // Split along the brighter diagonal, otherwise the occlusion gets
+    // stretched across the quad unevenly
+    const VertexIdx base = (VertexIdx)mesh->num_vertexes;
+    static const uint8_t split_02[6] = { 0, 1, 2, 0, 2, 3 };
+    static const uint8_t split_13[6] = { 1, 2, 3, 1, 3, 0 };
+    const uint8_t *order = ao[0] + ao[2] >= ao[1] + ao[3] ? split_02 : split_13;
+    for (int i = 0; i < 6; i++) {
+        mesh->indexes[mesh->num_indexes++] = base + order[i];
+    }
+    mesh->num_vertexes += 4;
+}
+
+void mesh_section(struct World *world, const struct Chunk *chunk, int sy,
+                    struct Arena *arena, struct SectionMesh *mesh) {
+    PROFILE_ZONE("mesh_section");
+    *mesh = (struct SectionMesh) {
+        .vertexes = NULL,
+        .indexes = NULL,
+        .num_vertexes = 0,
+        .num_indexes = 0,
+    };
+    if (!chunk->sections[sy] && chunk->uniform[sy] == BLOCK_AIR) {
+        return;
+    }
+
+    struct PaddedBlocks padded, *pad = &padded;
+    padded_copy(pad, world, chunk->x, sy, chunk->z, PADDED_SECTION, arena);
+
+    // Count the faces first so the buffers can be sized exactly
+    uint8_t *visible = arena_alloc(arena, SECTION_BLOCKS);
+    assert(visible && "Out of memory!");
+    size_t faces = 0;
+    for (int i = 0; i < SECTION_BLOCKS; i++) {
+        const int x = i % CHUNK_WIDTH, z = i / CHUNK_WIDTH % CHUNK_WIDTH, y = i / (CHUNK_WIDTH * CHUNK_WIDTH);
+        const int p = MESH_OFS(x + 1, y + 1, z + 1);
+        const BlockId id = pad->blocks[p];
+        visible[i] = 0;
+        if (id == BLOCK_AIR) {
+            continue;
+        }
+        for (int f = 0; f < 6; f++) {
+            const int n = p + mesh_faces[f].normal;
+            // Neighbours of the same kind hide each other, so water and glass
+            // don't show their insides
+            if (!(pad->flags[n] & PADDED_OPAQUE) && pad->blocks[n] != id) {
+                visible[i] |= 1 << f;
+                faces++;
+            }
+        }
+    }
+    if (!faces) {
+        return;
+    }
+    // Can't get past this even with every other block set
+    assert(faces * 4 <= UINT16_MAX + 1);
+
+    mesh->vertexes = arena_alloc(arena, sizeof(struct Vertex) * faces * 4);
+    mesh->indexes = arena_alloc(arena, sizeof(VertexIdx) * faces * 6);
+    assert(mesh->vertexes && mesh->indexes && "Out of memory!");
+    for (int i = 0; i < SECTION_BLOCKS; i++) {
+        if (!visible[i]) {
+            continue;
+        }
+        const int x = i % CHUNK_WIDTH, z = i / CHUNK_WIDTH % CHUNK_WIDTH, y = i / (CHUNK_WIDTH * CHUNK_WIDTH);
+        const int p = MESH_OFS(x + 1, y + 1, z + 1);
+        const uint8_t layer = block_get(pad->blocks[p])->texture;
+        for (int f = 0; f < 6; f++) {
+            if (visible[i] & (1 << f)) {
+                mesh_emit_face(pad, &mesh_faces[f], p, x, sy * SECTION_HEIGHT + y, z, layer, mesh);
+            }
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef _MESH_H
+#define _MESH_H
+#include <stddef.h>
+
+#include "model.h"
+#include "world.h"
+
+struct SectionMesh {
+    struct Vertex *vertexes;
+    VertexIdx *indexes;
+    size_t num_vertexes, num_indexes;
+};
+
+// Builds the visible faces of one section with smooth light and ambient
+// occlusion baked into the vertexes. Positions are relative to the chunk's
+// corner and everything is allocated from arena. Neighbour chunks that aren't
+// loaded read as air in full sky. Uniform air sections come back empty
+// without any work.
+void mesh_section(struct World *world, const struct Chunk *chunk, int sy,
+                    struct Arena *arena, struct SectionMesh *mesh);
+
+#endif
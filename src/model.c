@@ -101,6 +101,8 @@ void model_draw(struct Model *model) {
 size_t vertex_attrib_creator(struct Model *model, const struct Shader *shader) {
     GLint pos_loc = glGetAttribLocation(shader->program, "in_pos");
     GLint uv_loc = glGetAttribLocation(shader->program, "in_uv");
+    GLint light_loc = glGetAttribLocation(shader->program, "in_light");
+    GLint layer_loc = glGetAttribLocation(shader->program, "in_layer");
     if (pos_loc != -1) {
         glEnableVertexAttribArray(pos_loc);
         glVertexAttribPointer(pos_loc, 3, GL_FLOAT, GL_FALSE, sizeof(struct Vertex), (void *)0);
@@ -109,6 +111,14 @@ size_t vertex_attrib_creator(struct Model *model, const struct Shader *shader) {
         glEnableVertexAttribArray(uv_loc);
         glVertexAttribPointer(uv_loc, 2, GL_FLOAT, GL_FALSE, sizeof(struct Vertex), (void *)offsetof(struct Vertex, uv));
     }
+    if (light_loc != -1) {
+        glEnableVertexAttribArray(light_loc);
+        glVertexAttribPointer(light_loc, 3, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(struct Vertex), (void *)offsetof(struct Vertex, light));
+    }
+    if (layer_loc != -1) {
+        glEnableVertexAttribArray(layer_loc);
+        glVertexAttribPointer(layer_loc, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(struct Vertex), (void *)offsetof(struct Vertex, layer));
+    }
     return sizeof(struct Vertex);
 }
 size_t model_matrix_attrib_creator(struct Model *model, const struct Shader *shader) {
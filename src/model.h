@@ -15,6 +15,11 @@ typedef uint16_t VertexIdx;
 struct Vertex {
     vec3 pos;
     vec2 uv;
+    // Sky and block light summed over the 4 blocks around the vertex (0-60)
+    // and ambient occlusion, 0 for a fully covered corner up to 3 for none
+    uint8_t light[3];
+    // Texture array layer
+    uint8_t layer;
 };
 
 struct ModelMatrixInstance {
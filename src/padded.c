@@ -0,0 +1,103 @@
+#include <assert.h>
+#include <string.h>
+
+#include "padded.h"
+#include "profile.h"
+
+// Copies count blocks of a row starting at x, chunk can be NULL
+static void padded_copy_row(const struct Chunk *chunk, int x, int y, int z, int count,
+                                BlockId *blocks, uint8_t *light) {
+    if (y < 0) {
+        for (int i = 0; i < count; i++) {
+            blocks[i] = BLOCK_STONE;
+        }
+        memset(light, 0, count);
+        return;
+    }
+    if (y >= CHUNK_HEIGHT || !chunk) {
+        for (int i = 0; i < count; i++) {
+            blocks[i] = BLOCK_AIR;
+        }
+        memset(light, LIGHT_FULL_SKY, count);
+        return;
+    }
+
+    const int sy = y / SECTION_HEIGHT;
+#ifdef SECTION_MORTON
+    // Rows aren't contiguous, every block is looked up on its own
+    const struct Section *section = chunk->sections[sy];
+    const struct SectionLight *section_light = chunk->light[sy];
+    for (int i = 0; i < count; i++) {
+        const size_t index = section_block_index(x + i, y % SECTION_HEIGHT, z);
+        blocks[i] = section ? section->blocks[index] : chunk->uniform[sy];
+        light[i] = section_light ? section_light->levels[index] : chunk->light_fill[sy];
+    }
+#else
+    const size_t start = section_block_index(x, y % SECTION_HEIGHT, z);
+    if (chunk->sections[sy]) {
+        memcpy(blocks, &chunk->sections[sy]->blocks[start], sizeof(BlockId) * count);
+    } else {
+        for (int i = 0; i < count; i++) {
+            blocks[i] = chunk->uniform[sy];
+        }
+    }
+    if (chunk->light[sy]) {
+        memcpy(light, &chunk->light[sy]->levels[start], count);
+    } else {
+        memset(light, chunk->light_fill[sy], count);
+    }
+#endif
+}
+
+void padded_copy(struct PaddedBlocks *pad, struct World *world, int32_t sx, int sy, int32_t sz,
+                    int size, struct Arena *arena) {
+    PROFILE_ZONE("padded_copy");
+    assert(size == PADDED_SECTION || size == PADDED_REGION);
+    const size_t count = (size_t)size * size * size;
+    *pad = (struct PaddedBlocks) {
+        .size = size,
+        .x = sx * CHUNK_WIDTH - 1,
+        .y = sy * SECTION_HEIGHT - 1,
+        .z = sz * CHUNK_WIDTH - 1,
+        .blocks = arena_alloc(arena, sizeof(BlockId) * count),
+        .light = arena_alloc(arena, count),
+        .flags = arena_alloc(arena, count),
+    };
+    assert(pad->blocks && pad->light && pad->flags && "Out of memory!");
+
+    // Every chunk the cube touches, looked up once. The border reaches one
+    // chunk further on both sides.
+    const struct Chunk *near[4][4];
+    const int chunks = (size - 2) / CHUNK_WIDTH + 2;
+    for (int z = 0; z < chunks; z++) {
+        for (int x = 0; x < chunks; x++) {
+            near[z][x] = world_get_chunk(world, sx + x - 1, sz + z - 1);
+        }
+    }
+
+    for (int py = 0; py < size; py++) {
+        for (int pz = 0; pz < size; pz++) {
+            const int32_t z = pad->z + pz;
+            const struct Chunk *const *row = near[world_to_chunk(z) - sz + 1];
+            size_t i = padded_index(pad, 0, py, pz);
+            // Split the row wherever it crosses into the next chunk
+            for (int px = 0; px < size;) {
+                const int32_t x = pad->x + px;
+                const int lx = x & (CHUNK_WIDTH - 1);
+                int run = CHUNK_WIDTH - lx;
+                if (run > size - px) {
+                    run = size - px;
+                }
+                padded_copy_row(row[world_to_chunk(x) - sx + 1], lx, pad->y + py, z & (CHUNK_WIDTH - 1),
+                                run, &pad->blocks[i], &pad->light[i]);
+                px += run;
+                i += run;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct BlockType *type = block_get(pad->blocks[i]);
+        pad->flags[i] = (type->opaque ? PADDED_OPAQUE : 0) | (type->blocks_motion ? PADDED_BLOCKS_MOTION : 0);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _PADDED_H
+#define _PADDED_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "world.h"
+
+// Edge lengths of the two supported copies: one section or a 2x2x2 block of
+// them, plus the border
+#define PADDED_SECTION (SECTION_HEIGHT + 2)
+#define PADDED_REGION (2 * SECTION_HEIGHT + 2)
+
+// Block properties resolved once while copying
+enum {
+    PADDED_OPAQUE = 1 << 0,
+    PADDED_BLOCKS_MOTION = 1 << 1,
+};
+
+// A cube of blocks with a one block border from everything around it, so
+// kernels can reach any neighbour at a fixed stride without going through
+// chunks. Same x, z, y order as sections.
+struct PaddedBlocks {
+    // Blocks along each edge, border included
+    int size;
+    // World position of the first block, one less than the interior's corner
+    int32_t x, y, z;
+    BlockId *blocks;
+    uint8_t *light;
+    uint8_t *flags;
+};
+
+// Padded coordinates, the interior runs from 1 to size - 2
+static inline size_t padded_index(const struct PaddedBlocks *pad, int x, int y, int z) {
+    return x + z * pad->size + y * pad->size * pad->size;
+}
+// Copies the cube with its interior corner at section (sx, sy, sz), size is
+// PADDED_SECTION or PADDED_REGION. Everything's allocated from arena.
+// Unloaded chunks and above the world read as air in full sky, below the
+// world is dark stone.
+void padded_copy(struct PaddedBlocks *pad, struct World *world, int32_t sx, int sy, int32_t sz,
+                    int size, struct Arena *arena);
+
+#endif
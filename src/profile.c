@@ -0,0 +1,248 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mem.h"
+#include "profile.h"
+
+// Binary dump:
+//  u32 magic, u32 version
+//  u32 string count, then each string as u16 length + bytes
+//  u32 thread count, then per thread:
+//   u32 thread id, u32 name string (UINT32_MAX if unnamed), u32 event count
+//   events as u32 name string, u64 begin ns, u64 duration ns
+// Everything is little endian and times are since profile_init.
+#define PROFILE_BINARY_MAGIC 0x4650434D // "MCPF"
+#define PROFILE_BINARY_VERSION 1
+#define PROFILE_NO_STRING UINT32_MAX
+
+static _Atomic(struct ProfileBuffer *) profile_buffers;
+static atomic_uint profile_thread_ids;
+static uint64_t profile_epoch;
+static _Thread_local struct ProfileBuffer *profile_local;
+
+void profile_init(void) {
+    profile_epoch = time_ticks();
+}
+uint64_t profile_ticks_to_ns(uint64_t ticks) {
+    return ticks > profile_epoch ? time_ticks_to_ns(ticks - profile_epoch) : 0;
+}
+
+static struct ProfileBuffer *profile_add_buffer(const char *name, bool ns_times) {
+    MEM_TAG_SCOPE(MEM_TAG_PROFILE);
+    struct ProfileBuffer *buffer = mem_alloc(sizeof(struct ProfileBuffer));
+    assert(buffer && "Out of memory!");
+    buffer->thread_name = name;
+    buffer->thread_id = atomic_fetch_add(&profile_thread_ids, 1) + 1;
+    buffer->ns_times = ns_times;
+    atomic_init(&buffer->count, 0);
+    buffer->next = atomic_load(&profile_buffers);
+    while (!atomic_compare_exchange_weak(&profile_buffers, &buffer->next, buffer));
+    return buffer;
+}
+static struct ProfileBuffer *profile_get_buffer(void) {
+    if (!profile_local) {
+        profile_local = profile_add_buffer(NULL, false);
+    }
+    return profile_local;
+}
+struct ProfileBuffer *profile_create_track(const char *name) {
+    return profile_add_buffer(name, true);
+}
+void profile_set_thread_name(const char *name) {
+    profile_get_buffer()->thread_name = name;
+}
+static inline void profile_push(struct ProfileBuffer *buffer, const char *name, uint64_t begin, uint64_t end) {
+    uint_fast64_t count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    struct ProfileEvent *event = &buffer->events[count % PROFILE_BUFFER_SIZE];
+    event->name = name;
+    event->begin = begin;
+    event->end = end;
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+void profile_record(const char *name, uint64_t begin, uint64_t end) {
+    profile_push(profile_get_buffer(), name, begin, end);
+}
+void profile_record_ns(struct ProfileBuffer *track, const char *name, uint64_t begin_ns, uint64_t end_ns) {
+    assert(track->ns_times);
+    profile_push(track, name, begin_ns, end_ns);
+}
+static inline uint64_t profile_event_ns(const struct ProfileBuffer *buffer, uint64_t time) {
+    return buffer->ns_times ? time : profile_ticks_to_ns(time);
+}
+
+// Copies out the events of a buffer that is still being written to. Returns
+// the number of events, dropping any the thread overwrote during the copy.
+static size_t profile_copy_events(struct ProfileBuffer *buffer, struct ProfileEvent *out) {
+    uint_fast64_t count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+    uint_fast64_t first = count > PROFILE_BUFFER_SIZE ? count - PROFILE_BUFFER_SIZE : 0;
+    for (uint_fast64_t i = first; i < count; i++) {
+        out[i - first] = buffer->events[i % PROFILE_BUFFER_SIZE];
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    uint_fast64_t after = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    uint_fast64_t valid = after + 1 > PROFILE_BUFFER_SIZE ? after + 1 - PROFILE_BUFFER_SIZE : 0;
+    if (valid > first) {
+        size_t dropped = valid > count ? count - first : valid - first;
+        memmove(out, out + dropped, sizeof(*out) * (count - first - dropped));
+        return count - first - dropped;
+    }
+    return count - first;
+}
+
+static void profile_write_json_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*str, file);
+    }
+    fputc('"', file);
+}
+bool profile_dump_chrome(const char *path) {
+    MEM_TAG_SCOPE(MEM_TAG_PROFILE);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("profile error: Can't open the file %s\n", path);
+        return false;
+    }
+    struct ProfileEvent *events = mem_alloc(sizeof(struct ProfileEvent) * PROFILE_BUFFER_SIZE);
+    bool first = true;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (struct ProfileBuffer *buffer = atomic_load(&profile_buffers); buffer; buffer = buffer->next) {
+        if (buffer->thread_name) {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",", buffer->thread_id);
+            profile_write_json_string(file, buffer->thread_name);
+            fprintf(file, "}}");
+            first = false;
+        }
+
+        size_t count = profile_copy_events(buffer, events);
+        for (size_t i = 0; i < count; i++) {
+            uint64_t begin = profile_event_ns(buffer, events[i].begin);
+            uint64_t end = profile_event_ns(buffer, events[i].end);
+            fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+            profile_write_json_string(file, events[i].name);
+            fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    buffer->thread_id, (double)begin / 1000.0, (double)(end - begin) / 1000.0);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    mem_free(events);
+    if (fclose(file) != 0) {
+        printf("profile error: Couldn't write the file %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void profile_write_u16(FILE *file, uint16_t v) {
+    uint8_t b[2] = { v, v >> 8 };
+    fwrite(b, 1, sizeof(b), file);
+}
+static void profile_write_u32(FILE *file, uint32_t v) {
+    uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    fwrite(b, 1, sizeof(b), file);
+}
+static void profile_write_u64(FILE *file, uint64_t v) {
+    profile_write_u32(file, v);
+    profile_write_u32(file, v >> 32);
+}
+// Names are string literals, so a few distinct pointers cover every event
+static uint32_t profile_string_index(const char ***strings, size_t *num, size_t *cap, const char *str) {
+    if (!str) {
+        return PROFILE_NO_STRING;
+    }
+    for (size_t i = 0; i < *num; i++) {
+        if ((*strings)[i] == str) {
+            return i;
+        }
+    }
+    if (*num == *cap) {
+        *cap *= 2;
+        *strings = mem_realloc(*strings, sizeof(**strings) * *cap);
+    }
+    (*strings)[*num] = str;
+    return (*num)++;
+}
+bool profile_dump_binary(const char *path) {
+    MEM_TAG_SCOPE(MEM_TAG_PROFILE);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("profile error: Can't open the file %s\n", path);
+        return false;
+    }
+
+    // Snapshot every buffer first, the string table goes before the events
+    size_t num_threads = 0, num_strings = 0, strings_cap = 64;
+    const char **strings = mem_alloc(sizeof(*strings) * strings_cap);
+    struct ProfileBuffer *const buffers = atomic_load(&profile_buffers);
+    for (struct ProfileBuffer *buffer = buffers; buffer; buffer = buffer->next) {
+        num_threads++;
+    }
+    struct ProfileEvent **events = mem_alloc(sizeof(*events) * (num_threads ? num_threads : 1));
+    size_t *counts = mem_alloc(sizeof(*counts) * (num_threads ? num_threads : 1));
+    struct ProfileBuffer *buffer = buffers;
+    for (size_t t = 0; t < num_threads; t++, buffer = buffer->next) {
+        events[t] = mem_alloc(sizeof(struct ProfileEvent) * PROFILE_BUFFER_SIZE);
+        counts[t] = profile_copy_events(buffer, events[t]);
+        profile_string_index(&strings, &num_strings, &strings_cap, buffer->thread_name);
+        for (size_t i = 0; i < counts[t]; i++) {
+            profile_string_index(&strings, &num_strings, &strings_cap, events[t][i].name);
+        }
+    }
+
+    profile_write_u32(file, PROFILE_BINARY_MAGIC);
+    profile_write_u32(file, PROFILE_BINARY_VERSION);
+    profile_write_u32(file, num_strings);
+    for (size_t i = 0; i < num_strings; i++) {
+        size_t len = strlen(strings[i]);
+        profile_write_u16(file, len);
+        fwrite(strings[i], 1, len, file);
+    }
+    profile_write_u32(file, num_threads);
+    buffer = buffers;
+    for (size_t t = 0; t < num_threads; t++, buffer = buffer->next) {
+        profile_write_u32(file, buffer->thread_id);
+        profile_write_u32(file, profile_string_index(&strings, &num_strings, &strings_cap, buffer->thread_name));
+        profile_write_u32(file, counts[t]);
+        for (size_t i = 0; i < counts[t]; i++) {
+            uint64_t begin = profile_event_ns(buffer, events[t][i].begin);
+            uint64_t end = profile_event_ns(buffer, events[t][i].end);
+            profile_write_u32(file, profile_string_index(&strings, &num_strings, &strings_cap, events[t][i].name));
+            profile_write_u64(file, begin);
+            profile_write_u64(file, end - begin);
+        }
+        mem_free(events[t]);
+    }
+
+    mem_free(counts);
+    mem_free(events);
+    mem_free(strings);
+    if (fclose(file) != 0) {
+        printf("profile error: Couldn't write the file %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+void profile_shutdown(const char *path) {
+    if (path && atomic_load(&profile_buffers)) {
+        profile_dump_chrome(path);
+    }
+
+    // Every other thread has to be done by now
+    struct ProfileBuffer *buffer = atomic_exchange(&profile_buffers, NULL);
+    while (buffer) {
+        struct ProfileBuffer *next = buffer->next;
+        mem_free(buffer);
+        buffer = next;
+    }
+    profile_local = NULL;
+}
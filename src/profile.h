@@ -0,0 +1,78 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "system.h"
+
+// Zones are compiled in for debug builds, or release builds with -DPROFILE
+#if defined(DEBUG) || defined(PROFILE)
+# define PROFILE_ENABLED
+#endif
+
+// Events kept per thread, older ones get overwritten
+#define PROFILE_BUFFER_SIZE (64 * 1024)
+
+struct ProfileEvent {
+    // Has to be a string literal (only the pointer is stored)
+    const char *name;
+    uint64_t begin, end;
+};
+// Written only by its thread, the event count is published with a release
+// store so a dump from any other thread never has to take a lock
+struct ProfileBuffer {
+    struct ProfileBuffer *next;
+    const char *thread_name;
+    uint32_t thread_id;
+    // Tracks that aren't a cpu thread (like the gpu's) store nanoseconds since
+    // profile_init instead of time_ticks timestamps
+    bool ns_times;
+    atomic_uint_fast64_t count;
+    struct ProfileEvent events[PROFILE_BUFFER_SIZE];
+};
+struct ProfileZone {
+    const char *name;
+    uint64_t begin;
+};
+
+void profile_init(void);
+// Dumps to path if it isn't NULL and frees every thread's buffer
+void profile_shutdown(const char *path);
+// Chrome trace event json, open it in chrome://tracing or ui.perfetto.dev
+bool profile_dump_chrome(const char *path);
+// Compact binary dump, see profile.c for the format
+bool profile_dump_binary(const char *path);
+
+void profile_set_thread_name(const char *name);
+void profile_record(const char *name, uint64_t begin, uint64_t end);
+// Creates a separate timeline, it must only be recorded to by one thread at a time
+struct ProfileBuffer *profile_create_track(const char *name);
+void profile_record_ns(struct ProfileBuffer *track, const char *name, uint64_t begin_ns, uint64_t end_ns);
+// Nanoseconds since profile_init for a time_ticks timestamp
+uint64_t profile_ticks_to_ns(uint64_t ticks);
+
+static inline struct ProfileZone profile_zone_begin(const char *name) {
+    return (struct ProfileZone) {
+        .name = name,
+        .begin = time_ticks(),
+    };
+}
+static inline void profile_zone_end(struct ProfileZone *zone) {
+    profile_record(zone->name, zone->begin, time_ticks());
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifdef PROFILE_ENABLED
+// Times the rest of the enclosing scope
+# define PROFILE_ZONE(name) \
+    struct ProfileZone PROFILE_CONCAT(_profile_zone_, __LINE__) \
+        __attribute__((cleanup(profile_zone_end))) = profile_zone_begin(name)
+# define PROFILE_THREAD(name) profile_set_thread_name(name)
+#else
+# define PROFILE_ZONE(name) (void)0
+# define PROFILE_THREAD(name) (void)0
+#endif
+
+#endif
@@ -0,0 +1,229 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <glad/glad.h>
+
+#include "mem.h"
+#include "profile.h"
+#include "render.h"
+#include "slab.h"
+
+#define RENDER_SNAPSHOT_NEW 0x80000000u
+// Per snapshot, mesh uploads while flying fast or loading in are the most
+// that ever pile up. Past the retained part, pages go back after a spike.
+#define RENDER_MESH_DATA_RESERVE (1024ull * 1024 * 1024)
+#define RENDER_MESH_DATA_RETAIN (4 * 1024 * 1024)
+#define RENDER_INITIAL_FREE_MESHES 256
+
+// Ready for the game thread to fill in again
+static void render_snapshot_clear(struct RenderSnapshot *snapshot) {
+    snapshot->mesh_updates = NULL;
+    snapshot->mesh_updates_end = NULL;
+    vm_arena_reset(snapshot->mesh_data);
+}
+static void renderer_free(struct Renderer *renderer) {
+    for (int i = 0; i < RENDER_SNAPSHOTS; i++) {
+        if (renderer->snapshots[i].mesh_data) {
+            vm_arena_destroy(renderer->snapshots[i].mesh_data);
+        }
+    }
+    mem_free(renderer->free_meshes);
+    mem_free(renderer);
+}
+
+static void renderer_draw_frame(struct Renderer *renderer, const struct RenderSnapshot *snapshot) {
+    {
+        PROFILE_ZONE("render_frame");
+        if (snapshot->w != renderer->viewport_w || snapshot->h != renderer->viewport_h) {
+            glViewport(0, 0, snapshot->w, snapshot->h);
+            renderer->viewport_w = snapshot->w;
+            renderer->viewport_h = snapshot->h;
+        }
+        renderer->draw(renderer, snapshot, renderer->data);
+    }
+    {
+        PROFILE_ZONE("swap");
+        SDL_GL_SwapWindow(renderer->window->window);
+        gpu_profiler_end_frame(renderer->gpu_prof);
+    }
+}
+
+#ifndef OSX
+static int renderer_thread(void *data) {
+    struct Renderer *renderer = data;
+    MEM_TAG_SCOPE(MEM_TAG_RENDER);
+    PROFILE_THREAD("render");
+    SDL_GL_MakeCurrent(renderer->window->window, renderer->window->context);
+
+    for (;;) {
+        SDL_SemWait(renderer->ready);
+        if (atomic_load(&renderer->quit)) {
+            break;
+        }
+
+        // Every ready is posted after a submit, so there's always a new snapshot here
+        unsigned latest = atomic_exchange(&renderer->latest, renderer->read);
+        assert(latest & RENDER_SNAPSHOT_NEW);
+        renderer->read = latest & ~RENDER_SNAPSHOT_NEW;
+        SDL_SemPost(renderer->consumed);
+
+        renderer_draw_frame(renderer, &renderer->snapshots[renderer->read]);
+    }
+
+    SDL_GL_MakeCurrent(renderer->window->window, NULL);
+    scratch_thread_shutdown();
+    slab_thread_shutdown();
+    mem_thread_shutdown();
+    return 0;
+}
+#endif
+
+struct Renderer *renderer_create(struct Window *window, struct GpuProfiler *gpu_prof,
+                                    RenderFunc draw, void *data) {
+    MEM_TAG_SCOPE(MEM_TAG_RENDER);
+    struct Renderer *renderer = mem_alloc(sizeof(struct Renderer));
+    assert(renderer && "Out of memory!");
+    *renderer = (struct Renderer) {
+        .window = window,
+        .gpu_prof = gpu_prof,
+        .draw = draw,
+        .data = data,
+        .write = 0,
+        .frame = 0,
+        .read = 1,
+        .viewport_w = window->w,
+        .viewport_h = window->h,
+        .free_meshes = mem_alloc(sizeof(uint32_t) * RENDER_INITIAL_FREE_MESHES),
+        .num_free_meshes = 0,
+        .free_meshes_cap = RENDER_INITIAL_FREE_MESHES,
+        .next_mesh = 1,
+        .ready = NULL,
+        .consumed = NULL,
+        .thread = NULL,
+    };
+    assert(renderer->free_meshes && "Out of memory!");
+    for (int i = 0; i < RENDER_SNAPSHOTS; i++) {
+        renderer->snapshots[i].num_instances = 0;
+        renderer->snapshots[i].num_chunks = 0;
+        renderer->snapshots[i].mesh_updates = NULL;
+        renderer->snapshots[i].mesh_updates_end = NULL;
+        renderer->snapshots[i].mesh_data = vm_arena_create(RENDER_MESH_DATA_RESERVE, RENDER_MESH_DATA_RETAIN);
+        if (!renderer->snapshots[i].mesh_data) {
+            printf("Couldn't reserve memory for mesh uploads\n");
+            renderer_free(renderer);
+            return NULL;
+        }
+    }
+    atomic_init(&renderer->latest, 2);
+    atomic_init(&renderer->quit, false);
+
+#ifdef OSX
+    // Cocoa only lets the main thread present, so frames are drawn in
+    // renderer_submit and the context never moves
+    return renderer;
+#else
+    // A context can only be current on one thread
+    SDL_GL_MakeCurrent(window->window, NULL);
+    renderer->ready = SDL_CreateSemaphore(0);
+    renderer->consumed = SDL_CreateSemaphore(0);
+    if (renderer->ready && renderer->consumed) {
+        renderer->thread = SDL_CreateThread(renderer_thread, "render", renderer);
+    }
+    if (!renderer->thread) {
+        printf("SDL2 error: %s\n", SDL_GetError());
+        SDL_GL_MakeCurrent(window->window, window->context);
+        if (renderer->ready) SDL_DestroySemaphore(renderer->ready);
+        if (renderer->consumed) SDL_DestroySemaphore(renderer->consumed);
+        renderer_free(renderer);
+        return NULL;
+    }
+    return renderer;
+#endif
+}
+void renderer_destroy(struct Renderer *renderer) {
+#ifndef OSX
+    atomic_store(&renderer->quit, true);
+    SDL_SemPost(renderer->ready);
+    SDL_WaitThread(renderer->thread, NULL);
+    SDL_GL_MakeCurrent(renderer->window->window, renderer->window->context);
+
+    SDL_DestroySemaphore(renderer->consumed);
+    SDL_DestroySemaphore(renderer->ready);
+#endif
+    renderer_free(renderer);
+}
+
+struct RenderSnapshot *renderer_begin_frame(struct Renderer *renderer) {
+    return &renderer->snapshots[renderer->write];
+}
+void renderer_submit(struct Renderer *renderer) {
+    renderer->snapshots[renderer->write].frame = renderer->frame++;
+#ifdef OSX
+    // Drawn before it returns, so the same snapshot can be filled in again
+    renderer_draw_frame(renderer, &renderer->snapshots[renderer->write]);
+    render_snapshot_clear(&renderer->snapshots[renderer->write]);
+#else
+    // Whatever was latest before is never read now, so it's free to write to
+    unsigned prev = atomic_exchange(&renderer->latest, renderer->write | RENDER_SNAPSHOT_NEW);
+    renderer->write = prev & ~RENDER_SNAPSHOT_NEW;
+    render_snapshot_clear(&renderer->snapshots[renderer->write]);
+    SDL_SemPost(renderer->ready);
+
+    PROFILE_ZONE("wait_render");
+    SDL_SemWait(renderer->consumed);
+#endif
+}
+
+static struct RenderMeshUpdate *renderer_push_mesh_update(struct Renderer *renderer, uint32_t mesh, bool drop) {
+    struct RenderSnapshot *snapshot = &renderer->snapshots[renderer->write];
+    struct RenderMeshUpdate *update = vm_arena_alloc(snapshot->mesh_data, sizeof(struct RenderMeshUpdate));
+    assert(update && "Out of memory!");
+    *update = (struct RenderMeshUpdate) {
+        .next = NULL,
+        .mesh = mesh,
+        .drop = drop,
+    };
+    if (snapshot->mesh_updates_end) {
+        snapshot->mesh_updates_end->next = update;
+    } else {
+        snapshot->mesh_updates = update;
+    }
+    snapshot->mesh_updates_end = update;
+    return update;
+}
+uint32_t renderer_mesh_create(struct Renderer *renderer) {
+    if (renderer->num_free_meshes) {
+        return renderer->free_meshes[--renderer->num_free_meshes];
+    }
+    return renderer->next_mesh++;
+}
+void renderer_mesh_upload(struct Renderer *renderer, uint32_t mesh, const struct SectionMesh sections[CHUNK_SECTIONS]) {
+    struct VmArena *arena = renderer->snapshots[renderer->write].mesh_data;
+    struct RenderMeshUpdate *update = renderer_push_mesh_update(renderer, mesh, false);
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        const struct SectionMesh *from = &sections[sy];
+        if (!from->num_indexes) {
+            continue;
+        }
+        struct SectionMesh *to = &update->sections[sy];
+        *to = (struct SectionMesh) {
+            .vertexes = vm_arena_alloc(arena, sizeof(struct Vertex) * from->num_vertexes),
+            .indexes = vm_arena_alloc(arena, sizeof(VertexIdx) * from->num_indexes),
+            .num_vertexes = from->num_vertexes,
+            .num_indexes = from->num_indexes,
+        };
+        assert(to->vertexes && to->indexes && "Out of memory!");
+        memcpy(to->vertexes, from->vertexes, sizeof(struct Vertex) * from->num_vertexes);
+        memcpy(to->indexes, from->indexes, sizeof(VertexIdx) * from->num_indexes);
+    }
+}
+void renderer_mesh_destroy(struct Renderer *renderer, uint32_t mesh) {
+    renderer_push_mesh_update(renderer, mesh, true);
+    if (renderer->num_free_meshes == renderer->free_meshes_cap) {
+        MEM_TAG_SCOPE(MEM_TAG_RENDER);
+        renderer->free_meshes_cap *= 2;
+        renderer->free_meshes = mem_realloc(renderer->free_meshes, sizeof(uint32_t) * renderer->free_meshes_cap);
+        assert(renderer->free_meshes && "Out of memory!");
+    }
+    renderer->free_meshes[renderer->num_free_meshes++] = mesh;
+}
@@ -0,0 +1,111 @@
+#ifndef _RENDER_H
+#define _RENDER_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include <SDL.h>
+
+#include "gpuprofile.h"
+#include "mem.h"
+#include "mesh.h"
+#include "window.h"
+
+#define RENDER_MAX_INSTANCES 256
+// Visible chunks a frame can draw, past a 32 chunk view distance
+#define RENDER_MAX_CHUNKS 4096
+#define RENDER_SNAPSHOTS 3
+
+// One chunk to draw
+struct RenderChunk {
+    // From renderer_mesh_create
+    uint32_t mesh;
+    // Level of detail its meshes were built at
+    uint8_t lod;
+    // Corner of the chunk, mesh positions are relative to it
+    vec3 origin;
+};
+// New meshes for every section of a chunk, or drop set to free them
+struct RenderMeshUpdate {
+    struct RenderMeshUpdate *next;
+    uint32_t mesh;
+    bool drop;
+    struct SectionMesh sections[CHUNK_SECTIONS];
+};
+
+// Everything the render thread needs to draw a frame. The game thread fills
+// one in and never touches it again once it's submitted.
+struct RenderSnapshot {
+    uint64_t frame;
+    uint32_t w, h;
+    mat4 proj, view;
+    size_t num_instances;
+    mat4 instances[RENDER_MAX_INSTANCES];
+    // Frustum culled on the game thread, the render thread draws just these
+    size_t num_chunks;
+    struct RenderChunk chunks[RENDER_MAX_CHUNKS];
+    // In the order they were made, to apply before drawing. Every snapshot
+    // gets drawn, so none are missed.
+    struct RenderMeshUpdate *mesh_updates, *mesh_updates_end;
+    // The updates and their vertexes, reset once the snapshot's been drawn
+    struct VmArena *mesh_data;
+};
+
+struct Renderer;
+// Called on the render thread with the GL context current (on macOS that's
+// the main thread, from renderer_submit)
+typedef void(*RenderFunc)(struct Renderer *renderer, const struct RenderSnapshot *snapshot, void *data);
+
+// Triple buffered: the game thread writes one snapshot while the render
+// thread reads another, and the third is the latest finished one. They're
+// swapped with an atomic exchange so neither side ever takes a lock.
+// macOS only lets the main thread present, so there it's no thread and
+// one snapshot drawn right away.
+struct Renderer {
+    struct Window *window;
+    struct GpuProfiler *gpu_prof;
+    RenderFunc draw;
+    void *data;
+
+    struct RenderSnapshot snapshots[RENDER_SNAPSHOTS];
+    // Only touched by the game thread
+    uint32_t write;
+    uint64_t frame;
+    // Mesh handles given back, and one past the highest ever handed out
+    uint32_t *free_meshes;
+    size_t num_free_meshes, free_meshes_cap;
+    uint32_t next_mesh;
+    // Only touched by the render thread
+    uint32_t read, viewport_w, viewport_h;
+    // Index of the latest snapshot, RENDER_SNAPSHOT_NEW is set until it's read
+    atomic_uint latest;
+
+    SDL_Thread *thread;
+    // Ready wakes the render thread, consumed lets the game thread run at
+    // most one frame ahead of it
+    SDL_sem *ready, *consumed;
+    atomic_bool quit;
+};
+
+// Hands the window's GL context over to a new render thread, so create every
+// GL resource before this (except on macOS, where the caller keeps it).
+// Returns NULL (keeping the context) on failure
+struct Renderer *renderer_create(struct Window *window, struct GpuProfiler *gpu_prof,
+                                    RenderFunc draw, void *data);
+// Stops the render thread and makes the context current on the caller again
+void renderer_destroy(struct Renderer *renderer);
+// The snapshot to fill in for the next frame
+struct RenderSnapshot *renderer_begin_frame(struct Renderer *renderer);
+// Publishes the snapshot, blocks while the render thread is a whole frame behind
+void renderer_submit(struct Renderer *renderer);
+// Handle for a new set of chunk meshes, never 0. Handles are small and
+// reused, so the render thread can keep what it makes of them in an array.
+uint32_t renderer_mesh_create(struct Renderer *renderer);
+// Copies the meshes into the snapshot being filled in, the render thread
+// replaces the mesh's sections with them before drawing it
+void renderer_mesh_upload(struct Renderer *renderer, uint32_t mesh, const struct SectionMesh sections[CHUNK_SECTIONS]);
+// The render thread frees what it made of the mesh before drawing the
+// snapshot being filled in. The handle can be reused right away.
+void renderer_mesh_destroy(struct Renderer *renderer, uint32_t mesh);
+
+#endif
@@ -0,0 +1,408 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "file.h"
+#include "lz.h"
+#include "profile.h"
+#include "save.h"
+#include "slab.h"
+#include "system.h"
+
+// Chunk file: header, the block every missing section is made of (since
+// version 2, before that they were air) then an lz stream of the present
+// sections (bottom up)
+#define CHUNK_FILE_MAGIC 0x4B43434D // "MCCK"
+#define CHUNK_FILE_VERSION 2
+struct ChunkFileHeader {
+    uint32_t magic, version;
+    int32_t x, z;
+    uint32_t section_mask;
+};
+
+#ifdef SECTION_MORTON
+// Files keep blocks in linear order whatever the layout in memory is
+static void save_section_to_linear(const struct Section *section, BlockId *linear) {
+    for (size_t i = 0; i < SECTION_BLOCKS; i++) {
+        int x, y, z;
+        section_block_pos(i, &x, &y, &z);
+        linear[x + z * CHUNK_WIDTH + y * CHUNK_WIDTH * CHUNK_WIDTH] = section->blocks[i];
+    }
+}
+static void save_section_from_linear(struct Section *section, const BlockId *linear) {
+    for (size_t i = 0; i < SECTION_BLOCKS; i++) {
+        int x, y, z;
+        section_block_pos(i, &x, &y, &z);
+        section->blocks[i] = linear[x + z * CHUNK_WIDTH + y * CHUNK_WIDTH * CHUNK_WIDTH];
+    }
+}
+#endif
+
+static void chunk_file_path(char *buf, size_t size, const char *dir, int32_t x, int32_t z) {
+    snprintf(buf, size, "%s/%d.%d.chunk", dir, (int)x, (int)z);
+}
+
+uint8_t *save_encode_chunk(int32_t x, int32_t z, struct Section *const sections[CHUNK_SECTIONS],
+                            const BlockId uniform[CHUNK_SECTIONS], struct Arena *arena, size_t *size) {
+    struct ChunkFileHeader header = (struct ChunkFileHeader) {
+        .magic = CHUNK_FILE_MAGIC,
+        .version = CHUNK_FILE_VERSION,
+        .x = x,
+        .z = z,
+        .section_mask = 0,
+    };
+    struct LzWriter writer;
+
+    lz_writer_begin(&writer, arena);
+#ifdef SECTION_MORTON
+    BlockId *linear = arena_alloc(arena, sizeof(BlockId) * SECTION_BLOCKS);
+#endif
+    BlockId file_uniform[CHUNK_SECTIONS];
+    memcpy(file_uniform, uniform, sizeof(file_uniform));
+    for (int i = 0; i < CHUNK_SECTIONS; i++) {
+        // Edits can leave a section all one block, the file stores it like
+        // any other uniform one (the chunk is compacted later, if at all)
+        bool same = sections[i] != NULL;
+        for (int b = 1; same && b < SECTION_BLOCKS; b++) {
+            same = sections[i]->blocks[b] == sections[i]->blocks[0];
+        }
+        if (same) {
+            file_uniform[i] = sections[i]->blocks[0];
+        } else if (sections[i]) {
+            header.section_mask |= 1 << i;
+#ifdef SECTION_MORTON
+            save_section_to_linear(sections[i], linear);
+            lz_writer_write(&writer, linear, sizeof(BlockId) * SECTION_BLOCKS);
+#else
+            lz_writer_write(&writer, sections[i]->blocks, sizeof(sections[i]->blocks));
+#endif
+        }
+    }
+
+    size_t stream_size;
+    uint8_t *stream = lz_writer_end(&writer, &stream_size);
+    const size_t uniform_size = sizeof(BlockId) * CHUNK_SECTIONS;
+    *size = sizeof(header) + uniform_size + stream_size;
+    uint8_t *buf = arena_alloc(arena, *size);
+    assert(buf && "Out of memory!");
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), file_uniform, uniform_size);
+    memcpy(buf + sizeof(header) + uniform_size, stream, stream_size);
+    return buf;
+}
+struct Chunk *save_decode_chunk(struct World *world, const uint8_t *buf, size_t size,
+                                    int32_t x, int32_t z, struct Arena *arena) {
+    struct ChunkFileHeader header;
+    struct LzReader reader;
+
+    if (size < sizeof(header)) {
+        return NULL;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != CHUNK_FILE_MAGIC || header.version < 1 || header.version > CHUNK_FILE_VERSION
+        || header.x != x || header.z != z) {
+        return NULL;
+    }
+    BlockId uniform[CHUNK_SECTIONS] = {0};
+    size_t offset = sizeof(header);
+    if (header.version >= 2) {
+        if (size < offset + sizeof(uniform)) {
+            return NULL;
+        }
+        memcpy(uniform, buf + offset, sizeof(uniform));
+        offset += sizeof(uniform);
+    }
+
+    struct Chunk *chunk = world_get_chunk(world, x, z);
+    if (chunk) {
+        return chunk;
+    }
+    chunk = world_load_chunk(world, x, z);
+    memcpy(chunk->uniform, uniform, sizeof(uniform));
+    lz_reader_begin(&reader, arena, buf + offset, size - offset);
+#ifdef SECTION_MORTON
+    BlockId *linear = arena_alloc(arena, sizeof(BlockId) * SECTION_BLOCKS);
+#endif
+    for (int i = 0; i < CHUNK_SECTIONS; i++) {
+        if (!(header.section_mask & (1 << i))) {
+            continue;
+        }
+        struct Section *section = chunk_get_writable_section(world, chunk, i);
+#ifdef SECTION_MORTON
+        BlockId *blocks = linear;
+#else
+        BlockId *blocks = section->blocks;
+#endif
+        if (lz_reader_read(&reader, blocks, sizeof(BlockId) * SECTION_BLOCKS) != sizeof(BlockId) * SECTION_BLOCKS) {
+            world_unload_chunk(world, chunk);
+            return NULL;
+        }
+#ifdef SECTION_MORTON
+        save_section_from_linear(section, linear);
+#endif
+    }
+    chunk_compact(world, chunk);
+    chunk_build_heightmaps(chunk);
+    light_chunk_init(world, chunk);
+    return chunk;
+}
+
+bool save_write_chunk(const char *dir, int32_t x, int32_t z,
+                        struct Section *const sections[CHUNK_SECTIONS],
+                        const BlockId uniform[CHUNK_SECTIONS], struct Arena *scratch) {
+    size_t size;
+    struct ArenaMark mark = arena_mark(scratch);
+    uint8_t *buf = save_encode_chunk(x, z, sections, uniform, scratch, &size);
+
+    char path[512];
+    chunk_file_path(path, sizeof(path), dir, x, z);
+    bool written = file_write(path, buf, size);
+    arena_rewind(scratch, mark);
+    return written;
+}
+struct Chunk *save_read_chunk(struct World *world, const char *dir,
+                                int32_t x, int32_t z, struct Arena *scratch) {
+    char path[512];
+    size_t size;
+
+    struct ArenaMark mark = arena_mark(scratch);
+    chunk_file_path(path, sizeof(path), dir, x, z);
+    uint8_t *buf = file_load(arena_alloc_interface(), scratch, path, &size);
+    if (!buf) {
+        arena_rewind(scratch, mark);
+        return NULL;
+    }
+    struct Chunk *chunk = save_decode_chunk(world, buf, size, x, z, scratch);
+    if (!chunk) {
+        printf("save error: The chunk file %s is corrupt\n", path);
+    }
+    arena_rewind(scratch, mark);
+    return chunk;
+}
+
+static int autosave_thread(void *data) {
+    struct Autosave *save = data;
+    MEM_TAG_SCOPE(MEM_TAG_SAVE);
+    struct Arena *scratch = arena_create(256 * 1024);
+    PROFILE_THREAD("autosave");
+
+    SDL_LockMutex(save->lock);
+    for (;;) {
+        while (!save->queue && !save->quit) {
+            SDL_CondWait(save->wake, save->lock);
+        }
+        if (!save->queue) {
+            break;
+        }
+        struct SaveJob *job = save->queue;
+        save->queue = job->next;
+        if (!save->queue) {
+            save->queue_end = NULL;
+        }
+        save->busy = true;
+        save->current = job;
+        SDL_UnlockMutex(save->lock);
+
+        {
+            PROFILE_ZONE("save_chunk");
+            job->failed = !save_write_chunk(save->dir, job->x, job->z, job->sections, job->uniform, scratch);
+        }
+
+        SDL_LockMutex(save->lock);
+        job->next = save->done;
+        save->done = job;
+        save->current = NULL;
+        save->busy = false;
+        SDL_CondBroadcast(save->idle);
+    }
+    SDL_UnlockMutex(save->lock);
+
+    arena_destroy(scratch);
+    slab_thread_shutdown();
+    mem_thread_shutdown();
+    return 0;
+}
+
+struct Autosave *autosave_create(struct World *world, const char *dir, double interval) {
+    MEM_TAG_SCOPE(MEM_TAG_SAVE);
+    if (!file_make_dir(dir)) {
+        printf("autosave error: Can't create the save directory %s\n", dir);
+        return NULL;
+    }
+
+    struct Autosave *save = mem_alloc(sizeof(struct Autosave));
+    assert(save && "Out of memory!");
+    *save = (struct Autosave) {
+        .world = world,
+        .dir = dir,
+        .interval = interval,
+        .last_save = get_time(),
+        .job_pool = pool_create(64, sizeof(struct SaveJob), true),
+        .jobs_in_flight = 0,
+        .lock = SDL_CreateMutex(),
+        .wake = SDL_CreateCond(),
+        .idle = SDL_CreateCond(),
+        .queue = NULL,
+        .queue_end = NULL,
+        .done = NULL,
+        .current = NULL,
+        .busy = false,
+        .quit = false,
+    };
+    save->thread = SDL_CreateThread(autosave_thread, "autosave", save);
+    if (!save->lock || !save->wake || !save->idle || !save->thread) {
+        printf("SDL2 error: %s\n", SDL_GetError());
+        if (save->lock) SDL_DestroyMutex(save->lock);
+        if (save->wake) SDL_DestroyCond(save->wake);
+        if (save->idle) SDL_DestroyCond(save->idle);
+        pool_destroy(save->job_pool);
+        mem_free(save);
+        return NULL;
+    }
+    return save;
+}
+void autosave_destroy(struct Autosave *save) {
+    autosave_flush(save);
+
+    SDL_LockMutex(save->lock);
+    save->quit = true;
+    SDL_CondSignal(save->wake);
+    SDL_UnlockMutex(save->lock);
+    SDL_WaitThread(save->thread, NULL);
+
+    SDL_DestroyCond(save->idle);
+    SDL_DestroyCond(save->wake);
+    SDL_DestroyMutex(save->lock);
+    pool_destroy(save->job_pool);
+    mem_free(save);
+}
+
+// Gives the sections of written snapshots back to the world
+static void autosave_reclaim(struct Autosave *save) {
+    SDL_LockMutex(save->lock);
+    struct SaveJob *job = save->done;
+    save->done = NULL;
+    SDL_UnlockMutex(save->lock);
+
+    while (job) {
+        struct SaveJob *next = job->next;
+        struct Chunk *chunk = world_get_chunk_by_handle(save->world, job->chunk);
+        for (int i = 0; i < CHUNK_SECTIONS; i++) {
+            if (job->sections[i]) {
+                section_release(save->world, job->sections[i]);
+            }
+        }
+        if (chunk) {
+            chunk->saving = false;
+            if (job->failed) {
+                world_mark_dirty(save->world, chunk);
+            }
+        }
+        pool_free(save->job_pool, job);
+        save->jobs_in_flight--;
+        job = next;
+    }
+}
+void autosave_update(struct Autosave *save) {
+    autosave_reclaim(save);
+
+    double now = get_time();
+    if (now - save->last_save >= save->interval) {
+        save->last_save = now;
+        autosave_snapshot(save);
+    }
+}
+// Takes references to the chunk's sections, nothing is copied or scanned
+static struct SaveJob *autosave_make_job(struct Autosave *save, struct Chunk *chunk) {
+    struct World *world = save->world;
+    struct SaveJob *job = pool_alloc(save->job_pool);
+    assert(job && "Out of memory!");
+    job->next = NULL;
+    job->chunk = chunk->handle;
+    job->x = chunk->x;
+    job->z = chunk->z;
+    job->failed = false;
+    memcpy(job->sections, chunk->sections, sizeof(job->sections));
+    memcpy(job->uniform, chunk->uniform, sizeof(job->uniform));
+    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+        if (chunk->sections[s]) {
+            section_retain(chunk->sections[s]);
+        }
+    }
+    chunk->saving = true;
+    world_clear_dirty(world, chunk);
+    save->jobs_in_flight++;
+    return job;
+}
+static void autosave_push(struct Autosave *save, struct SaveJob *first, struct SaveJob *last) {
+    SDL_LockMutex(save->lock);
+    if (save->queue_end) {
+        save->queue_end->next = first;
+    } else {
+        save->queue = first;
+    }
+    save->queue_end = last;
+    SDL_CondSignal(save->wake);
+    SDL_UnlockMutex(save->lock);
+}
+void autosave_snapshot(struct Autosave *save) {
+    PROFILE_ZONE("autosave_snapshot");
+    struct World *world = save->world;
+    struct SaveJob *first = NULL, *last = NULL;
+
+    for (size_t i = 0; i < world->num_dirty;) {
+        struct Chunk *chunk = world_get_chunk_by_handle(world, world->dirty[i]);
+        if (chunk->saving) {
+            // The last snapshot is still being written, catch it next time
+            i++;
+            continue;
+        }
+
+        struct SaveJob *job = autosave_make_job(save, chunk);
+        if (last) {
+            last->next = job;
+        } else {
+            first = job;
+        }
+        last = job;
+    }
+    if (first) {
+        autosave_push(save, first, last);
+    }
+}
+void autosave_chunk(struct Autosave *save, struct Chunk *chunk) {
+    if (!chunk->dirty) {
+        return;
+    }
+    // Jobs are written in order, so this one lands after any older snapshot
+    // of the chunk that's still queued
+    struct SaveJob *job = autosave_make_job(save, chunk);
+    autosave_push(save, job, job);
+}
+static bool save_jobs_have(const struct SaveJob *job, int32_t x, int32_t z) {
+    for (; job; job = job->next) {
+        if (job->x == x && job->z == z) {
+            return true;
+        }
+    }
+    return false;
+}
+bool autosave_pending(struct Autosave *save, int32_t x, int32_t z) {
+    SDL_LockMutex(save->lock);
+    bool pending = save_jobs_have(save->queue, x, z) || save_jobs_have(save->done, x, z)
+        || (save->current && save->current->x == x && save->current->z == z);
+    SDL_UnlockMutex(save->lock);
+    return pending;
+}
+void autosave_flush(struct Autosave *save) {
+    // Second pass picks up chunks that were still being written the first time
+    for (int pass = 0; pass < 2; pass++) {
+        autosave_snapshot(save);
+        SDL_LockMutex(save->lock);
+        while (save->queue || save->busy) {
+            SDL_CondWait(save->idle, save->lock);
+        }
+        SDL_UnlockMutex(save->lock);
+        autosave_reclaim(save);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef _SAVE_H
+#define _SAVE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#include "mem.h"
+#include "world.h"
+
+// Copy-on-write snapshot of one chunk. It holds a reference to every
+// section, so the chunk clones any it writes to (see chunk_get_writable_section).
+struct SaveJob {
+    struct SaveJob *next;
+    // Goes stale if the chunk is unloaded
+    Handle chunk;
+    int32_t x, z;
+    struct Section *sections[CHUNK_SECTIONS];
+    BlockId uniform[CHUNK_SECTIONS];
+    bool failed;
+};
+
+struct Autosave {
+    struct World *world;
+    const char *dir;
+    double interval, last_save;
+
+    // Only touched by the main thread
+    struct Pool *job_pool;
+    size_t jobs_in_flight;
+
+    // Shared with the save thread
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *wake, *idle;
+    struct SaveJob *queue, *queue_end, *done;
+    // The job the save thread is writing
+    struct SaveJob *current;
+    bool busy, quit;
+};
+
+// Writes chunks to dir/<x>.<z>.chunk every interval seconds.
+// Returns NULL if the save thread can't be started
+struct Autosave *autosave_create(struct World *world, const char *dir, double interval);
+// Saves everything that's still dirty and waits for it to finish
+void autosave_destroy(struct Autosave *save);
+// Call once per tick. Snapshots dirty chunks when the interval is up and
+// gives the sections of finished snapshots back to the world.
+void autosave_update(struct Autosave *save);
+// Only takes references to the sections of dirty chunks, the writing
+// happens on the save thread
+void autosave_snapshot(struct Autosave *save);
+void autosave_flush(struct Autosave *save);
+// Snapshots one chunk right away if it's dirty. Only unload it once
+// chunk->saving is clear again: until then the snapshot is the only copy
+// of its edits, and a failed write marks the chunk dirty again.
+void autosave_chunk(struct Autosave *save, struct Chunk *chunk);
+// A snapshot of the chunk hasn't been written (or reclaimed) yet, its file
+// is stale until then
+bool autosave_pending(struct Autosave *save, int32_t x, int32_t z);
+
+// The chunk file format in memory, allocated from arena
+uint8_t *save_encode_chunk(int32_t x, int32_t z, struct Section *const sections[CHUNK_SECTIONS],
+                            const BlockId uniform[CHUNK_SECTIONS], struct Arena *arena, size_t *size);
+// Loads and lights an encoded chunk, returns NULL if it's corrupt. Takes
+// scratch space from arena.
+struct Chunk *save_decode_chunk(struct World *world, const uint8_t *buf, size_t size,
+                                    int32_t x, int32_t z, struct Arena *arena);
+// Serializes the sections of a chunk, scratch is rewound to where it was
+// before returning
+bool save_write_chunk(const char *dir, int32_t x, int32_t z,
+                        struct Section *const sections[CHUNK_SECTIONS],
+                        const BlockId uniform[CHUNK_SECTIONS], struct Arena *scratch);
+// Loads a saved chunk into the world, returns NULL if it was never saved.
+// Same as save_write_chunk with scratch.
+struct Chunk *save_read_chunk(struct World *world, const char *dir,
+                                int32_t x, int32_t z, struct Arena *scratch);
+
+#endif
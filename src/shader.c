@@ -124,6 +124,12 @@ void textured_shader_uniforms(struct Shader *shader) {
     shader->uniforms.textured.texture =
         glGetUniformLocation(shader->program, "diffuse");
 }
+void chunk_shader_uniforms(struct Shader *shader) {
+    shader->uniforms.chunk.texture =
+        glGetUniformLocation(shader->program, "diffuse");
+    shader->uniforms.chunk.origin =
+        glGetUniformLocation(shader->program, "origin");
+}
 
 void *uniformbuffer_create(GLuint binding, size_t inst_size, size_t inst_count, GLenum usage) {
     struct UniformBuffer *buffer = malloc(sizeof(struct UniformBuffer) + inst_size * inst_count);
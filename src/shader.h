@@ -11,11 +11,15 @@ typedef void(*UniformLoader)(struct Shader *shader);
 struct TexturedShader {
     GLint texture;
 };
+struct ChunkShader {
+    GLint texture, origin;
+};
 
 struct Shader {
     GLuint program;
     union {
         struct TexturedShader textured;
+        struct ChunkShader chunk;
     } uniforms;
 };
 struct ShaderResult {
@@ -33,6 +37,7 @@ void shader_set_binding(struct Shader *program,
                             const char *uniform);
 
 void textured_shader_uniforms(struct Shader *shader);
+void chunk_shader_uniforms(struct Shader *shader);
 
 static inline void shader_set_matrix(GLint uniform_loc, mat4 matrix) {
     glUniformMatrix4fv(uniform_loc, 1, GL_FALSE, (void *)matrix);
@@ -0,0 +1,206 @@
+#include <assert.h>
+
+#include "slab.h"
+
+// Every allocated block starts with its size class, free blocks reuse it
+// (and the start of the block) for the free list links
+struct SlabHeader {
+    uint32_t size_class;
+    uint32_t pad;
+};
+
+const uint32_t slab_class_sizes[SLAB_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256,
+    384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
+
+_Static_assert(sizeof(struct SlabFree) <= sizeof(struct SlabHeader) + 16,
+                "The smallest class has to fit a free block");
+
+// Roughly what every chunk holds, at least one batch of the class
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+static struct SlabCentral slab_central[SLAB_CLASSES];
+// Size class for every 16 bytes up to SLAB_MAX_SIZE
+static uint8_t slab_class_lookup[SLAB_MAX_SIZE / 16 + 1];
+static _Thread_local struct SlabCache slab_caches[SLAB_CLASSES];
+
+static inline void slab_lock(struct SlabCentral *central) {
+    while (atomic_flag_test_and_set_explicit(&central->lock, memory_order_acquire));
+}
+static inline void slab_unlock(struct SlabCentral *central) {
+    atomic_flag_clear_explicit(&central->lock, memory_order_release);
+}
+
+void slab_init(void) {
+    MEM_TAG_SCOPE(MEM_TAG_SLAB);
+    size_t size_class = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(slab_class_lookup); i++) {
+        while (slab_class_sizes[size_class] < i * 16) {
+            size_class++;
+        }
+        slab_class_lookup[i] = size_class;
+    }
+
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        struct SlabCentral *central = &slab_central[i];
+        atomic_flag_clear(&central->lock);
+        central->block_size = sizeof(struct SlabHeader) + slab_class_sizes[i];
+        central->chunks = NULL;
+        central->batches = NULL;
+    }
+}
+void slab_shutdown(void) {
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        struct SlabChunk *chunk = slab_central[i].chunks;
+        while (chunk) {
+            struct SlabChunk *next = chunk->next;
+            mem_pages_free(chunk, chunk->size, MEM_TAG_SLAB, chunk->huge);
+            chunk = next;
+        }
+        slab_central[i].chunks = NULL;
+        slab_central[i].batches = NULL;
+        slab_caches[i] = (struct SlabCache) { .free = NULL, .count = 0 };
+    }
+}
+
+// Hands the first SLAB_BATCH blocks of the cache to the central list
+static void slab_release_batch(size_t size_class) {
+    struct SlabCache *cache = &slab_caches[size_class];
+    struct SlabFree *batch = cache->free, *last = batch;
+    for (size_t i = 1; i < SLAB_BATCH; i++) {
+        last = last->next;
+    }
+    cache->free = last->next;
+    cache->count -= SLAB_BATCH;
+    last->next = NULL;
+    batch->count = SLAB_BATCH;
+
+    struct SlabCentral *central = &slab_central[size_class];
+    slab_lock(central);
+    batch->next_batch = central->batches;
+    central->batches = batch;
+    slab_unlock(central);
+}
+static void slab_refill(size_t size_class) {
+    struct SlabCache *cache = &slab_caches[size_class];
+    struct SlabCentral *central = &slab_central[size_class];
+
+    slab_lock(central);
+    struct SlabFree *taken = central->batches;
+    if (taken) {
+        central->batches = taken->next_batch;
+    }
+    slab_unlock(central);
+    if (taken) {
+        cache->free = taken;
+        cache->count = taken->count;
+        return;
+    }
+
+    // Nothing was given back yet. Map a new chunk (without the lock, it can
+    // take a while), keep its first batch and share the rest.
+    const size_t batch_size = central->block_size * SLAB_BATCH;
+    size_t size = mem_pages_size(sizeof(struct SlabChunk) + (batch_size > SLAB_CHUNK_SIZE ? batch_size : SLAB_CHUNK_SIZE));
+    size_t num_batches = (size - sizeof(struct SlabChunk)) / batch_size;
+    bool huge;
+    struct SlabChunk *chunk = mem_pages_alloc(size, MEM_TAG_SLAB, &huge);
+    assert(chunk && "Out of memory!");
+    chunk->size = size;
+    chunk->huge = huge;
+
+    struct SlabFree *first = NULL, *last = NULL;
+    for (size_t b = 0; b < num_batches; b++) {
+        uint8_t *start = chunk->data + b * batch_size;
+        struct SlabFree *batch = (struct SlabFree *)start;
+        for (size_t i = 0; i < SLAB_BATCH; i++) {
+            struct SlabFree *block = (struct SlabFree *)(start + i * central->block_size);
+            block->next = i + 1 < SLAB_BATCH ? (struct SlabFree *)(start + (i + 1) * central->block_size) : NULL;
+        }
+        batch->count = SLAB_BATCH;
+        batch->next_batch = NULL;
+        if (last) {
+            last->next_batch = batch;
+        } else {
+            first = batch;
+        }
+        last = batch;
+    }
+
+    slab_lock(central);
+    chunk->next = central->chunks;
+    central->chunks = chunk;
+    if (first != last) {
+        last->next_batch = central->batches;
+        central->batches = first->next_batch;
+    }
+    slab_unlock(central);
+    cache->free = first;
+    cache->count = SLAB_BATCH;
+}
+void slab_thread_shutdown(void) {
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        struct SlabCache *cache = &slab_caches[i];
+        while (cache->count >= SLAB_BATCH) {
+            slab_release_batch(i);
+        }
+        if (cache->count) {
+            struct SlabCentral *central = &slab_central[i];
+            cache->free->count = cache->count;
+            slab_lock(central);
+            cache->free->next_batch = central->batches;
+            central->batches = cache->free;
+            slab_unlock(central);
+        }
+        *cache = (struct SlabCache) { .free = NULL, .count = 0 };
+    }
+}
+
+void *slab_alloc(size_t size) {
+    assert(size);
+    struct SlabHeader *header;
+    if (size > SLAB_MAX_SIZE) {
+        header = mem_alloc(sizeof(struct SlabHeader) + size);
+        assert(header && "Out of memory!");
+        header->size_class = SLAB_LARGE;
+        return header + 1;
+    }
+
+    size_t size_class = slab_class_lookup[(size + 15) / 16];
+    struct SlabCache *cache = &slab_caches[size_class];
+    if (!cache->free) {
+        slab_refill(size_class);
+    }
+    struct SlabFree *block = cache->free;
+    cache->free = block->next;
+    cache->count--;
+
+    header = (struct SlabHeader *)block;
+    header->size_class = size_class;
+    return header + 1;
+}
+void *slab_free(void *block) {
+    assert(block && "Possible double free?");
+    struct SlabHeader *header = (struct SlabHeader *)block - 1;
+    if (header->size_class == SLAB_LARGE) {
+        return mem_free(header);
+    }
+
+    // Blocks go back to the freeing thread's cache, whoever allocated them
+    size_t size_class = header->size_class;
+    assert(size_class < SLAB_CLASSES && "Not a slab block!");
+    struct SlabCache *cache = &slab_caches[size_class];
+    struct SlabFree *free_block = (struct SlabFree *)header;
+    free_block->next = cache->free;
+    cache->free = free_block;
+    if (++cache->count >= SLAB_BATCH * 2) {
+        slab_release_batch(size_class);
+    }
+    return NULL;
+}
+static void *_slab_alloc(void *dummy, size_t size) {
+    return slab_alloc(size);
+}
+AllocInterface slab_alloc_interface(void) {
+    return _slab_alloc;
+}
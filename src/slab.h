@@ -0,0 +1,63 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+
+// Small object allocator: page chunks cut into blocks per size class, a per
+// thread cache in front of each and a shared free list the caches trade
+// batches with. Freed blocks are only ever reused, the chunks go back to
+// the os in slab_shutdown. Anything bigger than SLAB_MAX_SIZE goes straight
+// to mem_alloc.
+#define SLAB_CLASSES 16
+#define SLAB_MAX_SIZE 4096
+// Blocks moved between a thread cache and the central list at a time
+#define SLAB_BATCH 32
+// Size class index stored in front of blocks that came from mem_alloc
+#define SLAB_LARGE UINT32_MAX
+
+// Free blocks are chained through their first bytes, the first block of a
+// batch also holds the next batch and how many blocks it has
+struct SlabFree {
+    struct SlabFree *next;
+    struct SlabFree *next_batch;
+    uint32_t count;
+};
+struct SlabChunk {
+    struct SlabChunk *next;
+    // Came from mem_pages_alloc as a huge page mapping
+    bool huge;
+    // Bytes mapped, header included
+    size_t size;
+    uint8_t data[];
+};
+// The lock is only held to move pointers, never across an allocation
+struct SlabCentral {
+    atomic_flag lock;
+    struct SlabChunk *chunks;
+    struct SlabFree *batches;
+    size_t block_size;
+};
+struct SlabCache {
+    struct SlabFree *free;
+    uint32_t count;
+};
+
+extern const uint32_t slab_class_sizes[SLAB_CLASSES];
+
+// Call before any thread allocates
+void slab_init(void);
+// Frees every block of every class, other threads have to be done with them
+void slab_shutdown(void);
+// Gives the calling thread's cached blocks back, call it before the thread exits
+void slab_thread_shutdown(void);
+
+// Blocks are 8 byte aligned
+void *slab_alloc(size_t size);
+void *slab_free(void *block);
+AllocInterface slab_alloc_interface(void);
+
+#endif
@@ -0,0 +1,344 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "lod.h"
+#include "profile.h"
+#include "stream.h"
+#include "system.h"
+
+#define STREAM_INITIAL_JOBS 1024
+#define STREAM_BUDGET 0.004
+// Chunks out of range are evicted after this many seconds, or right away
+// once they're this many chunks past the load distance. Walking back and
+// forth over a border doesn't reload them.
+#define STREAM_EVICT_AFTER 5.0
+#define STREAM_EVICT_MARGIN 2
+// Seconds between rescans when the camera stays in the same chunk, picks
+// up jobs that couldn't run before and chunks edited since they were meshed
+#define STREAM_RESCAN_INTERVAL 0.5
+// Jobs go by distance to where the camera is going to be this many seconds on
+#define STREAM_LOOKAHEAD 1.5f
+// Seconds for the velocity to settle on a new speed
+#define STREAM_VELOCITY_SMOOTHING 0.25f
+// Chunks outside the frustum count as this much further away
+#define STREAM_OUTSIDE_VIEW_FACTOR 3.0f
+
+struct Streamer *streamer_create(struct World *world, struct Autosave *save, struct ChunkCache *cache,
+                                    int view_distance, StreamGenerateFunc generate, StreamMeshFunc mesh, void *data) {
+    MEM_TAG_SCOPE(MEM_TAG_WORLD);
+    struct Streamer *streamer = mem_alloc(sizeof(struct Streamer));
+    assert(streamer && "Out of memory!");
+    *streamer = (struct Streamer) {
+        .world = world,
+        .save = save,
+        .cache = cache,
+        .generate = generate,
+        .mesh = mesh,
+        .data = data,
+        .view_distance = view_distance,
+        .budget = STREAM_BUDGET,
+        .jobs = mem_alloc(sizeof(struct StreamJob) * STREAM_INITIAL_JOBS),
+        .num_jobs = 0,
+        .jobs_cap = STREAM_INITIAL_JOBS,
+        .velocity = { 0.0f, 0.0f, 0.0f },
+        .last_update = 0.0,
+        .last_scan = 0.0,
+        .scanned = false,
+    };
+    assert(streamer->jobs && "Out of memory!");
+    return streamer;
+}
+void streamer_destroy(struct Streamer *streamer) {
+    mem_free(streamer->jobs);
+    mem_free(streamer);
+}
+void streamer_print_stats(const struct Streamer *streamer) {
+    printf("stream: %llu chunks loaded (%llu generated), %llu meshed, %llu evicted, %zu jobs queued\n",
+            (unsigned long long)streamer->loaded, (unsigned long long)streamer->generated,
+            (unsigned long long)streamer->meshed, (unsigned long long)streamer->evicted, streamer->num_jobs);
+}
+
+static inline bool stream_in_range(int32_t dx, int32_t dz, int distance) {
+    return dx * dx + dz * dz <= distance * distance;
+}
+static bool stream_in_frustum(vec4 planes[6], int32_t x, int32_t z) {
+    vec3 box[2] = {
+        { (float)(x * CHUNK_WIDTH), 0.0f, (float)(z * CHUNK_WIDTH) },
+        { (float)((x + 1) * CHUNK_WIDTH), (float)CHUNK_HEIGHT, (float)((z + 1) * CHUNK_WIDTH) },
+    };
+    return glm_aabb_frustum(box, planes);
+}
+static float stream_priority(const struct StreamView *view, int32_t x, int32_t z) {
+    // Distance from where the camera is about to be, it's moving past
+    // whatever is around it now
+    const vec2 center = { x * CHUNK_WIDTH + CHUNK_WIDTH * 0.5f, z * CHUNK_WIDTH + CHUNK_WIDTH * 0.5f };
+    float priority = glm_vec2_distance((float *)center, (float *)view->ahead);
+    if (!stream_in_frustum((vec4 *)view->planes, x, z)) {
+        priority *= STREAM_OUTSIDE_VIEW_FACTOR;
+    }
+    return priority;
+}
+
+static void stream_sift_down(struct Streamer *streamer, size_t i) {
+    struct StreamJob *jobs = streamer->jobs;
+    for (;;) {
+        size_t least = i, left = i * 2 + 1, right = left + 1;
+        if (left < streamer->num_jobs && jobs[left].priority < jobs[least].priority) {
+            least = left;
+        }
+        if (right < streamer->num_jobs && jobs[right].priority < jobs[least].priority) {
+            least = right;
+        }
+        if (least == i) {
+            return;
+        }
+        struct StreamJob tmp = jobs[i];
+        jobs[i] = jobs[least];
+        jobs[least] = tmp;
+        i = least;
+    }
+}
+static void stream_push(struct Streamer *streamer, int32_t x, int32_t z, enum StreamJobType type) {
+    if (streamer->num_jobs == streamer->jobs_cap) {
+        MEM_TAG_SCOPE(MEM_TAG_WORLD);
+        streamer->jobs_cap *= 2;
+        streamer->jobs = mem_realloc(streamer->jobs, sizeof(struct StreamJob) * streamer->jobs_cap);
+        assert(streamer->jobs && "Out of memory!");
+    }
+    struct StreamJob *jobs = streamer->jobs;
+    size_t i = streamer->num_jobs++;
+    const struct StreamJob job = (struct StreamJob) {
+        .x = x,
+        .z = z,
+        .priority = stream_priority(&streamer->view, x, z),
+        .type = type,
+    };
+    while (i && jobs[(i - 1) / 2].priority > job.priority) {
+        jobs[i] = jobs[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    jobs[i] = job;
+}
+static struct StreamJob stream_pop(struct Streamer *streamer) {
+    struct StreamJob top = streamer->jobs[0];
+    streamer->jobs[0] = streamer->jobs[--streamer->num_jobs];
+    stream_sift_down(streamer, 0);
+    return top;
+}
+// The camera moved or turned, so every job gets a new priority
+static void stream_reprioritize(struct Streamer *streamer) {
+    for (size_t i = 0; i < streamer->num_jobs; i++) {
+        struct StreamJob *job = &streamer->jobs[i];
+        job->priority = stream_priority(&streamer->view, job->x, job->z);
+    }
+    for (size_t i = streamer->num_jobs / 2; i-- > 0;) {
+        stream_sift_down(streamer, i);
+    }
+}
+
+static inline int stream_lod(const struct Streamer *streamer, int32_t x, int32_t z) {
+    return lod_pick(streamer->view.pos[0], streamer->view.pos[1], x, z);
+}
+// Loaded, not meshed yet (or at another level) and with every neighbour
+// there to look into
+static struct Chunk *stream_mesh_ready(struct Streamer *streamer, int32_t x, int32_t z) {
+    if (!streamer->mesh || !stream_in_range(x - streamer->scan_x, z - streamer->scan_z, streamer->view_distance)) {
+        return NULL;
+    }
+    struct Chunk *chunk = world_get_chunk(streamer->world, x, z);
+    if (!chunk || (chunk->meshed && chunk->lod == stream_lod(streamer, x, z))) {
+        return NULL;
+    }
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if ((dx || dz) && !world_get_chunk(streamer->world, x + dx, z + dz)) {
+                return NULL;
+            }
+        }
+    }
+    return chunk;
+}
+
+static void stream_evict(struct Streamer *streamer, double now) {
+    PROFILE_ZONE("stream_evict");
+    struct World *world = streamer->world;
+    const int distance = streamer->view_distance + 1;
+    // Unloading moves the last chunk into the gap, going backwards means
+    // that one has already been looked at
+    for (size_t i = world->chunk_table->count; i-- > 0;) {
+        struct Chunk *chunk = handle_table_at(world->chunk_table, i);
+        const int32_t dx = chunk->x - streamer->scan_x, dz = chunk->z - streamer->scan_z;
+        if (stream_in_range(dx, dz, distance)) {
+            chunk->wanted_at = now;
+            continue;
+        }
+        if (stream_in_range(dx, dz, distance + STREAM_EVICT_MARGIN) && now - chunk->wanted_at < STREAM_EVICT_AFTER) {
+            continue;
+        }
+        if (streamer->save) {
+            // It stays loaded until its snapshot is written. A failed write
+            // marks it dirty again and the next pass snapshots it again,
+            // otherwise the edits would only be in the cache
+            autosave_chunk(streamer->save, chunk);
+            if (chunk->saving) {
+                continue;
+            }
+        }
+        if (streamer->cache) {
+            chunk_cache_store(streamer->cache, world, chunk);
+        }
+        if (streamer->mesh) {
+            streamer->mesh(chunk, NULL, streamer->data);
+        }
+        world_unload_chunk(world, chunk);
+        streamer->evicted++;
+    }
+}
+static void stream_scan(struct Streamer *streamer) {
+    PROFILE_ZONE("stream_scan");
+    const int distance = streamer->view_distance + 1;
+    streamer->num_jobs = 0;
+    for (int32_t dz = -distance; dz <= distance; dz++) {
+        for (int32_t dx = -distance; dx <= distance; dx++) {
+            if (!stream_in_range(dx, dz, distance)) {
+                continue;
+            }
+            const int32_t x = streamer->scan_x + dx, z = streamer->scan_z + dz;
+            if (!world_get_chunk(streamer->world, x, z)) {
+                stream_push(streamer, x, z, STREAM_LOAD);
+            } else if (stream_mesh_ready(streamer, x, z)) {
+                stream_push(streamer, x, z, STREAM_MESH);
+            }
+        }
+    }
+}
+
+static void stream_load(struct Streamer *streamer, int32_t x, int32_t z) {
+    struct World *world = streamer->world;
+    if (world_get_chunk(world, x, z)
+        || !stream_in_range(x - streamer->scan_x, z - streamer->scan_z, streamer->view_distance + 1)) {
+        return;
+    }
+    struct Chunk *chunk = streamer->cache ? chunk_cache_take(streamer->cache, world, x, z) : NULL;
+    if (!chunk && streamer->save) {
+        if (autosave_pending(streamer->save, x, z)) {
+            // Its file is about to change, the next scan tries again
+            return;
+        }
+        chunk = save_read_chunk(world, streamer->save->dir, x, z, scratch_arena());
+    }
+    if (!chunk) {
+        chunk = world_load_chunk(world, x, z);
+        if (streamer->generate) {
+            streamer->generate(world, chunk, streamer->data);
+        }
+        chunk_compact(world, chunk);
+        chunk_build_heightmaps(chunk);
+        light_chunk_init(world, chunk);
+        streamer->generated++;
+    }
+    chunk->wanted_at = streamer->last_update;
+    streamer->loaded++;
+
+    // This might have been the last neighbour some chunk was waiting for
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (stream_mesh_ready(streamer, x + dx, z + dz)) {
+                stream_push(streamer, x + dx, z + dz, STREAM_MESH);
+            }
+        }
+    }
+}
+static void stream_mesh(struct Streamer *streamer, int32_t x, int32_t z) {
+    struct Chunk *chunk = stream_mesh_ready(streamer, x, z);
+    if (!chunk) {
+        return;
+    }
+    // Edits since it was last meshed can leave sections uniform or the same
+    // as another chunk's, saving leaves that to whoever touches it next
+    chunk_compact(streamer->world, chunk);
+    // Light from the chunks loaded around it has to settle first
+    light_update(streamer->world);
+    struct SectionMesh meshes[CHUNK_SECTIONS];
+    struct Arena *scratch = scratch_arena();
+    struct ArenaMark scratch_mark = arena_mark(scratch);
+    chunk->lod = stream_lod(streamer, x, z);
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        lod_mesh_section(streamer->world, chunk, sy, chunk->lod, scratch, &meshes[sy]);
+    }
+    streamer->mesh(chunk, meshes, streamer->data);
+    arena_rewind(scratch, scratch_mark);
+    chunk->meshed = true;
+    streamer->meshed++;
+}
+
+static void stream_update_view(struct Streamer *streamer, struct Camera *cam, double now) {
+    const float dt = (float)(now - streamer->last_update);
+    if (streamer->scanned && dt > 0.0f) {
+        vec3 velocity;
+        glm_vec3_sub(cam->pos, streamer->last_pos, velocity);
+        glm_vec3_scale(velocity, 1.0f / dt, velocity);
+        glm_vec3_lerp(streamer->velocity, velocity, dt / (dt + STREAM_VELOCITY_SMOOTHING), streamer->velocity);
+    }
+    glm_vec3_copy(cam->pos, streamer->last_pos);
+    streamer->last_update = now;
+
+    struct StreamView *view = &streamer->view;
+    view->pos[0] = cam->pos[0];
+    view->pos[1] = cam->pos[2];
+    vec2 ahead = { streamer->velocity[0] * STREAM_LOOKAHEAD, streamer->velocity[2] * STREAM_LOOKAHEAD };
+    // Teleports and the like shouldn't send it off past the view distance
+    const float max_ahead = (float)(streamer->view_distance * CHUNK_WIDTH);
+    if (glm_vec2_norm(ahead) > max_ahead) {
+        glm_vec2_scale_as(ahead, max_ahead, ahead);
+    }
+    glm_vec2_add(view->pos, ahead, view->ahead);
+
+    mat4 mat;
+    camera_get_mat(cam, mat);
+    glm_frustum_planes(mat, view->planes);
+}
+void streamer_update(struct Streamer *streamer, struct Camera *cam) {
+    PROFILE_ZONE("stream_update");
+    const double now = get_time();
+    stream_update_view(streamer, cam, now);
+
+    const int32_t x = world_to_chunk((int32_t)floorf(cam->pos[0]));
+    const int32_t z = world_to_chunk((int32_t)floorf(cam->pos[2]));
+    if (!streamer->scanned || x != streamer->scan_x || z != streamer->scan_z
+        || now - streamer->last_scan >= STREAM_RESCAN_INTERVAL) {
+        streamer->scan_x = x;
+        streamer->scan_z = z;
+        streamer->last_scan = now;
+        streamer->scanned = true;
+        stream_evict(streamer, now);
+        stream_scan(streamer);
+    }
+    stream_reprioritize(streamer);
+
+    for (size_t done = 0; streamer->num_jobs && (!done || get_time() - now < streamer->budget); done++) {
+        const struct StreamJob job = stream_pop(streamer);
+        switch (job.type) {
+            case STREAM_LOAD: stream_load(streamer, job.x, job.z); break;
+            case STREAM_MESH: stream_mesh(streamer, job.x, job.z); break;
+        }
+    }
+}
+size_t streamer_visible(const struct Streamer *streamer, struct Camera *cam, struct Chunk **chunks, size_t max) {
+    PROFILE_ZONE("stream_visible");
+    mat4 mat;
+    vec4 planes[6];
+    camera_get_mat(cam, mat);
+    glm_frustum_planes(mat, planes);
+
+    size_t count = 0;
+    const struct HandleTable *table = streamer->world->chunk_table;
+    for (size_t i = 0; i < table->count && count < max; i++) {
+        struct Chunk *chunk = handle_table_at(table, i);
+        if (chunk->meshed && stream_in_frustum(planes, chunk->x, chunk->z)) {
+            chunks[count++] = chunk;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,89 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cglm/cglm.h>
+
+#include "cache.h"
+#include "camera.h"
+#include "mem.h"
+#include "mesh.h"
+#include "save.h"
+#include "world.h"
+
+// Fills a new, all air chunk with blocks when there's no save of it
+typedef void(*StreamGenerateFunc)(struct World *world, struct Chunk *chunk, void *data);
+// Gets the mesh of every section (bottom up) whenever a chunk is meshed,
+// at the level of detail in chunk->lod. They're only good until it returns.
+// meshes is NULL right before the chunk is unloaded, for it to free
+// whatever it made of them.
+typedef void(*StreamMeshFunc)(struct Chunk *chunk, const struct SectionMesh meshes[CHUNK_SECTIONS], void *data);
+
+enum StreamJobType {
+    STREAM_LOAD,
+    STREAM_MESH,
+};
+struct StreamJob {
+    int32_t x, z;
+    // Lowest goes first
+    float priority;
+    enum StreamJobType type;
+};
+// What jobs are prioritized by, worked out once per update
+struct StreamView {
+    // Where the camera is and where it's going to be soon, horizontally
+    vec2 pos, ahead;
+    vec4 planes[6];
+};
+
+// Keeps every chunk within view distance of the camera loaded and meshed,
+// a few jobs per update. Chunks are remeshed when their region's level of
+// detail changes. Jobs go in order of distance to where the camera is
+// headed, ones outside the view frustum last, so flying fast fills in what's
+// in front first. Chunks that drop out of range are evicted after a while,
+// into the cache if there is one.
+struct Streamer {
+    struct World *world;
+    // Where chunks are read from and evicted ones are written to, if not NULL
+    struct Autosave *save;
+    // Evicted chunks are kept compressed in it, if not NULL
+    struct ChunkCache *cache;
+    StreamGenerateFunc generate;
+    // Nothing is meshed if it's NULL
+    StreamMeshFunc mesh;
+    void *data;
+    // In chunks. Meshes need their neighbours, so one more ring is loaded.
+    int view_distance;
+    // Seconds of jobs per update, at least one always runs
+    double budget;
+
+    // Binary min heap on priority, the priorities are redone every update
+    struct StreamJob *jobs;
+    size_t num_jobs, jobs_cap;
+    struct StreamView view;
+    // Blocks per second, smoothed out
+    vec3 velocity, last_pos;
+    double last_update, last_scan;
+    // Chunk the camera was in at the last scan
+    int32_t scan_x, scan_z;
+    bool scanned;
+
+    uint64_t loaded, generated, meshed, evicted;
+};
+
+// Will never return NULL streamer. save, cache and generate can be NULL.
+struct Streamer *streamer_create(struct World *world, struct Autosave *save, struct ChunkCache *cache,
+                                    int view_distance, StreamGenerateFunc generate, StreamMeshFunc mesh, void *data);
+// Leaves the chunks loaded
+void streamer_destroy(struct Streamer *streamer);
+// Call once per frame from the main thread with the camera it's drawn from
+// (its aspect has to be set). Evicts chunks out of range once their save
+// is written (autosave_update has to run too), and runs jobs for up to
+// budget seconds.
+void streamer_update(struct Streamer *streamer, struct Camera *cam);
+// Puts up to max meshed chunks that cam can see in chunks, returns how many
+size_t streamer_visible(const struct Streamer *streamer, struct Camera *cam, struct Chunk **chunks, size_t max);
+void streamer_print_stats(const struct Streamer *streamer);
+
+#endif
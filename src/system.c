@@ -1,15 +1,156 @@
-#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#ifdef WIN32
+# include <windows.h>
+#endif
 
 #include "system.h"
+#ifdef SYSTEM_HAS_RDTSC
+# include <cpuid.h>
+#endif
 
-static uint64_t time_seconds, last_seconds;
-double get_time(void) {
+#define TIME_CALIBRATION_NS 5000000
+
+bool time_ticks_are_tsc;
+static uint64_t epoch_ns;
+static double ns_per_tick = 1.0;
+
+uint64_t time_ns(void) {
+#ifdef WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ull
+        + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ull / freq.QuadPart;
+#else
     struct timespec ts;
-    timespec_get(&ts, TIME_UTC);
-    if (last_seconds < ts.tv_sec || (ts.tv_sec < 10000 && last_seconds > 10000)) {
-        last_seconds = ts.tv_sec;
-        time_seconds++;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// The tsc is only usable as a clock if it ticks at a constant rate no matter
+// the power state (cpuid says so with the invariant tsc bit)
+static bool time_has_invariant_tsc(void) {
+#ifdef SYSTEM_HAS_RDTSC
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+#else
+    return false;
+#endif
+}
+void time_init(void) {
+    epoch_ns = time_ns();
+    time_ticks_are_tsc = time_has_invariant_tsc();
+    if (!time_ticks_are_tsc) {
+        ns_per_tick = 1.0;
+        return;
+    }
+
+    uint64_t start_ticks = time_ticks(), start_ns = time_ns(), end_ns;
+    while ((end_ns = time_ns()) - start_ns < TIME_CALIBRATION_NS);
+    uint64_t end_ticks = time_ticks();
+    ns_per_tick = (double)(end_ns - start_ns) / (double)(end_ticks - start_ticks);
+}
+double get_time(void) {
+    return (double)(time_ns() - epoch_ns) / 1000000000.0;
+}
+uint64_t time_ticks_to_ns(uint64_t ticks) {
+    return (uint64_t)((double)ticks * ns_per_tick);
+}
+
+void tick_clock_init(struct TickClock *clock, uint32_t rate_hz) {
+    clock->tick_ns = 1000000000ull / rate_hz;
+    clock->accumulator = 0;
+    clock->last = time_ns();
+    clock->max_catchup_ns = 1000000000ull;
+    clock->ticks = 0;
+}
+uint32_t tick_clock_advance(struct TickClock *clock) {
+    uint64_t now = time_ns(), elapsed = now - clock->last;
+    clock->last = now;
+    if (elapsed > clock->max_catchup_ns) {
+        elapsed = clock->max_catchup_ns;
+    }
+
+    clock->accumulator += elapsed;
+    uint32_t ticks = clock->accumulator / clock->tick_ns;
+    clock->accumulator -= (uint64_t)ticks * clock->tick_ns;
+    clock->ticks += ticks;
+    return ticks;
+}
+
+const double frame_stats_bucket_ms[FRAME_STATS_BUCKETS - 1] = {
+    2.0, 4.0, 6.95, 8.34, 16.7, 33.4, 66.7,
+};
+
+void frame_stats_init(struct FrameStats *stats) {
+    stats->head = 0;
+    stats->count = 0;
+    stats->last_frame = time_ns();
+}
+void frame_stats_tick(struct FrameStats *stats) {
+    uint64_t now = time_ns();
+    frame_stats_push(stats, now - stats->last_frame);
+    stats->last_frame = now;
+}
+void frame_stats_push(struct FrameStats *stats, uint64_t frame_ns) {
+    stats->frames[stats->head] = frame_ns;
+    stats->head = (stats->head + 1) % FRAME_STATS_SIZE;
+    if (stats->count < FRAME_STATS_SIZE) {
+        stats->count++;
+    }
+}
+static int frame_stats_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+struct FrameSummary frame_stats_summary(const struct FrameStats *stats) {
+    struct FrameSummary summary;
+    uint64_t sorted[FRAME_STATS_SIZE], total = 0;
+
+    memset(&summary, 0, sizeof(summary));
+    summary.count = stats->count;
+    if (!stats->count) {
+        return summary;
+    }
+
+    // Only the first count entries are filled before the buffer wraps
+    memcpy(sorted, stats->frames, sizeof(*sorted) * stats->count);
+    qsort(sorted, stats->count, sizeof(*sorted), frame_stats_compare);
+    for (size_t i = 0; i < stats->count; i++) {
+        double ms = (double)sorted[i] / 1000000.0;
+        size_t bucket = 0;
+        while (bucket < FRAME_STATS_BUCKETS - 1 && ms >= frame_stats_bucket_ms[bucket]) {
+            bucket++;
+        }
+        summary.histogram[bucket]++;
+        total += sorted[i];
+    }
+    summary.min_ms = (double)sorted[0] / 1000000.0;
+    summary.max_ms = (double)sorted[stats->count - 1] / 1000000.0;
+    summary.avg_ms = (double)total / (double)stats->count / 1000000.0;
+    summary.p99_ms = (double)sorted[(stats->count - 1) * 99 / 100] / 1000000.0;
+    return summary;
+}
+void frame_stats_print(const struct FrameStats *stats) {
+    struct FrameSummary summary = frame_stats_summary(stats);
+    printf("frame times (last %zu): min %.3fms avg %.3fms p99 %.3fms max %.3fms\n",
+            summary.count, summary.min_ms, summary.avg_ms, summary.p99_ms, summary.max_ms);
+    for (size_t i = 0; i < FRAME_STATS_BUCKETS; i++) {
+        if (i < FRAME_STATS_BUCKETS - 1) {
+            printf("  < %6.2fms: %u\n", frame_stats_bucket_ms[i], summary.histogram[i]);
+        } else {
+            printf("  >=%6.2fms: %u\n", frame_stats_bucket_ms[i - 1], summary.histogram[i]);
+        }
     }
-    return (double)time_seconds + (double)ts.tv_nsec / 1000000000.0;
 }
@@ -1,6 +1,73 @@
 #ifndef _SYSTEM_H
 #define _SYSTEM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# define SYSTEM_HAS_RDTSC
+#endif
 
+// Calibrates the cpu counter against the monotonic clock, call before anything else
+void time_init(void);
+// Monotonic clock in nanoseconds, never jumps when the wall clock is adjusted
+uint64_t time_ns(void);
+// Seconds since time_init
 double get_time(void);
 
+extern bool time_ticks_are_tsc;
+// Cheapest timestamp there is, only use time_ticks_to_ns on differences of it
+static inline uint64_t time_ticks(void) {
+#ifdef SYSTEM_HAS_RDTSC
+    if (time_ticks_are_tsc) {
+        return __rdtsc();
+    }
+#endif
+    return time_ns();
+}
+uint64_t time_ticks_to_ns(uint64_t ticks);
+
+// Fixed rate simulation clock. Every frame runs however many ticks are
+// needed to keep game time in step with real time, the renderer then
+// interpolates between the last two ticks with tick_clock_alpha.
+struct TickClock {
+    uint64_t tick_ns, accumulator, last;
+    // Stalls longer than this (breakpoints, window drags) are skipped over
+    // instead of being caught up on
+    uint64_t max_catchup_ns;
+    uint64_t ticks;
+};
+void tick_clock_init(struct TickClock *clock, uint32_t rate_hz);
+// Returns how many ticks to simulate this frame
+uint32_t tick_clock_advance(struct TickClock *clock);
+static inline float tick_clock_dt(const struct TickClock *clock) {
+    return (float)clock->tick_ns / 1000000000.0f;
+}
+static inline float tick_clock_alpha(const struct TickClock *clock) {
+    return (float)clock->accumulator / (float)clock->tick_ns;
+}
+
+// Ring buffer of the last FRAME_STATS_SIZE frame times
+#define FRAME_STATS_SIZE 1024
+#define FRAME_STATS_BUCKETS 8
+struct FrameStats {
+    uint64_t frames[FRAME_STATS_SIZE];
+    size_t head, count;
+    uint64_t last_frame;
+};
+struct FrameSummary {
+    size_t count;
+    double min_ms, avg_ms, p99_ms, max_ms;
+    // Frames under each of frame_stats_bucket_ms (the last bucket is everything else)
+    uint32_t histogram[FRAME_STATS_BUCKETS];
+};
+extern const double frame_stats_bucket_ms[FRAME_STATS_BUCKETS - 1];
+
+void frame_stats_init(struct FrameStats *stats);
+// Call once per frame, records the time since the last call
+void frame_stats_tick(struct FrameStats *stats);
+void frame_stats_push(struct FrameStats *stats, uint64_t frame_ns);
+struct FrameSummary frame_stats_summary(const struct FrameStats *stats);
+void frame_stats_print(const struct FrameStats *stats);
+
 #endif
@@ -85,8 +85,8 @@ void window_handle_events(struct Window *window) {
             window->wants_to_close = true;
             break;
         case SDL_WINDOWEVENT:
+            // The render thread picks the new size up from its next snapshot
             if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                glViewport(0, 0, event.window.data1, event.window.data2);
                 window->w = event.window.data1;
                 window->h = event.window.data2;
             }
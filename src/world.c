@@ -0,0 +1,410 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "save.h"
+#include "world.h"
+
+#define WORLD_INITIAL_CHUNKS 256
+// Empty section chunks kept around so walking back and forth doesn't thrash malloc
+#define WORLD_KEEP_EMPTY_SECTION_CHUNKS 2
+
+size_t table_remove_slot(void *slots, size_t elem_size, size_t cap, size_t i, TableHomeFunc home) {
+    uint8_t *bytes = slots;
+    size_t mask = cap - 1, j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        size_t h = home(bytes + j * elem_size, mask);
+        if (h == SIZE_MAX) {
+            return i;
+        }
+        // Entries that hash to somewhere from the gap up to j can stay
+        if ((j > i && (h <= i || h > j)) || (j < i && h <= i && h > j)) {
+            memcpy(bytes + i * elem_size, bytes + j * elem_size, elem_size);
+            i = j;
+        }
+    }
+}
+static size_t chunk_slot_home(const void *slot, size_t mask) {
+    const struct ChunkSlot *chunk = slot;
+    return chunk->handle ? chunk_pos_hash(chunk->x, chunk->z) & mask : SIZE_MAX;
+}
+static size_t dedup_slot_home(const void *slot, size_t mask) {
+    const struct Section *section = *(struct Section *const *)slot;
+    return section ? section->hash & mask : SIZE_MAX;
+}
+
+struct World *world_create(void) {
+    MEM_TAG_SCOPE(MEM_TAG_WORLD);
+    struct World *world = mem_alloc(sizeof(struct World));
+    assert(world && "Out of memory!");
+    world->chunk_table = handle_table_create(sizeof(struct Chunk), WORLD_INITIAL_CHUNKS);
+    world->section_pool = shared_pool_create(WORLD_INITIAL_CHUNKS * 4, sizeof(struct Section));
+    world->light_pool = pool_create(WORLD_INITIAL_CHUNKS, sizeof(struct SectionLight), true);
+    light_engine_init(&world->light);
+    world->num_chunks = 0;
+    world->chunks_cap = WORLD_INITIAL_CHUNKS * 2;
+    world->chunks = mem_alloc(sizeof(*world->chunks) * world->chunks_cap);
+    memset(world->chunks, 0, sizeof(*world->chunks) * world->chunks_cap);
+    world->num_dirty = 0;
+    world->dirty_cap = WORLD_INITIAL_CHUNKS;
+    world->dirty = mem_alloc(sizeof(*world->dirty) * world->dirty_cap);
+    world->num_dedup = 0;
+    world->dedup_cap = WORLD_INITIAL_CHUNKS * 4;
+    world->dedup = mem_alloc(sizeof(*world->dedup) * world->dedup_cap);
+    memset(world->dedup, 0, sizeof(*world->dedup) * world->dedup_cap);
+    world->sections_merged = 0;
+    world->sections_collapsed = 0;
+    return world;
+}
+void world_destroy(struct World *world) {
+    assert(world);
+    mem_free(world->dedup);
+    mem_free(world->dirty);
+    mem_free(world->chunks);
+    light_engine_destroy(&world->light);
+    pool_destroy(world->light_pool);
+    shared_pool_destroy(world->section_pool);
+    handle_table_destroy(world->chunk_table);
+    mem_free(world);
+}
+
+static size_t world_find_slot(struct World *world, int32_t x, int32_t z) {
+    size_t mask = world->chunks_cap - 1;
+    size_t i = chunk_pos_hash(x, z) & mask;
+    while (world->chunks[i].handle && (world->chunks[i].x != x || world->chunks[i].z != z)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+static void world_grow_chunks(struct World *world) {
+    MEM_TAG_SCOPE(MEM_TAG_WORLD);
+    struct ChunkSlot *old = world->chunks;
+    size_t old_cap = world->chunks_cap;
+
+    world->chunks_cap *= 2;
+    world->chunks = mem_alloc(sizeof(*world->chunks) * world->chunks_cap);
+    memset(world->chunks, 0, sizeof(*world->chunks) * world->chunks_cap);
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].handle) {
+            world->chunks[world_find_slot(world, old[i].x, old[i].z)] = old[i];
+        }
+    }
+    mem_free(old);
+}
+void world_trim(struct World *world) {
+    shared_pool_thread_trim(world->section_pool, WORLD_KEEP_EMPTY_SECTION_CHUNKS);
+}
+void world_print_stats(const struct World *world) {
+    printf("world: %zu chunks loaded, %zu dirty\n", world->num_chunks, world->num_dirty);
+    printf("chunks: %zu KiB\n", world->chunk_table->cap * sizeof(struct Chunk) / 1024);
+    printf("pool sections: %zu capacity, %zu KiB\n", shared_pool_capacity(world->section_pool),
+            shared_pool_capacity(world->section_pool) * world->section_pool->elem_size / 1024);
+    printf("sections: %zu deduped, %llu merged, %llu made uniform\n", world->num_dedup,
+            (unsigned long long)world->sections_merged, (unsigned long long)world->sections_collapsed);
+    pool_print_stats("light sections", world->light_pool);
+    printf("light: %llu nodes visited\n", (unsigned long long)world->light.nodes_visited);
+    printf("pages: %s, %zu KiB huge\n", mem_page_mode() == MEM_PAGES_HUGE ? "huge" : "small",
+            mem_huge_page_bytes() / 1024);
+}
+struct Chunk *world_get_chunk(struct World *world, int32_t x, int32_t z) {
+    struct ChunkSlot *slot = &world->chunks[world_find_slot(world, x, z)];
+    return slot->handle ? world_get_chunk_by_handle(world, slot->handle) : NULL;
+}
+struct Chunk *world_load_chunk(struct World *world, int32_t x, int32_t z) {
+    size_t slot = world_find_slot(world, x, z);
+    if (world->chunks[slot].handle) {
+        return world_get_chunk_by_handle(world, world->chunks[slot].handle);
+    }
+    if ((world->num_chunks + 1) * 10 > world->chunks_cap * 7) {
+        world_grow_chunks(world);
+        slot = world_find_slot(world, x, z);
+    }
+
+    struct Chunk *chunk;
+    Handle handle = handle_table_alloc(world->chunk_table, (void **)&chunk);
+    chunk->x = x;
+    chunk->z = z;
+    chunk->handle = handle;
+    // Nothing to block the sky yet
+    memset(chunk->light_fill, LIGHT_FULL_SKY, sizeof(chunk->light_fill));
+    world->chunks[slot] = (struct ChunkSlot) {
+        .x = x,
+        .z = z,
+        .handle = handle,
+    };
+    world->num_chunks++;
+    return chunk;
+}
+void world_clear_dirty(struct World *world, struct Chunk *chunk) {
+    if (!chunk->dirty) {
+        return;
+    }
+    Handle last = world->dirty[--world->num_dirty];
+    world->dirty[chunk->dirty_idx] = last;
+    world_get_chunk_by_handle(world, last)->dirty_idx = chunk->dirty_idx;
+    chunk->dirty = false;
+}
+void world_unload_chunk(struct World *world, struct Chunk *chunk) {
+    // Sections still shared with a snapshot or another chunk live on
+    world_clear_dirty(world, chunk);
+    for (int i = 0; i < CHUNK_SECTIONS; i++) {
+        if (chunk->sections[i]) {
+            section_release(world, chunk->sections[i]);
+        }
+        if (chunk->light[i]) {
+            pool_free(world->light_pool, chunk->light[i]);
+        }
+    }
+
+    size_t i = table_remove_slot(world->chunks, sizeof(*world->chunks), world->chunks_cap,
+                                    world_find_slot(world, chunk->x, chunk->z), chunk_slot_home);
+    world->chunks[i].handle = HANDLE_NULL;
+    world->num_chunks--;
+    handle_table_free(world->chunk_table, chunk->handle);
+}
+void world_mark_dirty(struct World *world, struct Chunk *chunk) {
+    if (chunk->dirty) {
+        return;
+    }
+    if (world->num_dirty == world->dirty_cap) {
+        world->dirty_cap *= 2;
+        world->dirty = mem_realloc(world->dirty, sizeof(*world->dirty) * world->dirty_cap);
+    }
+    chunk->dirty = true;
+    chunk->dirty_idx = world->num_dirty;
+    world->dirty[world->num_dirty++] = chunk->handle;
+}
+BlockId world_get_block(struct World *world, int32_t x, int32_t y, int32_t z) {
+    if (y < 0 || y >= CHUNK_HEIGHT) {
+        return BLOCK_AIR;
+    }
+    struct Chunk *chunk = world_get_chunk(world, world_to_chunk(x), world_to_chunk(z));
+    if (!chunk) {
+        return BLOCK_AIR;
+    }
+    return chunk_get_block(chunk, x & (CHUNK_WIDTH - 1), y, z & (CHUNK_WIDTH - 1));
+}
+int world_get_height(struct World *world, enum Heightmap map, int32_t x, int32_t z) {
+    struct Chunk *chunk = world_get_chunk(world, world_to_chunk(x), world_to_chunk(z));
+    if (!chunk) {
+        return 0;
+    }
+    return chunk_get_height(chunk, map, x & (CHUNK_WIDTH - 1), z & (CHUNK_WIDTH - 1));
+}
+void world_set_block(struct World *world, int32_t x, int32_t y, int32_t z, BlockId id) {
+    if (y < 0 || y >= CHUNK_HEIGHT) {
+        return;
+    }
+    struct Chunk *chunk = world_get_chunk(world, world_to_chunk(x), world_to_chunk(z));
+    if (!chunk) {
+        return;
+    }
+    chunk_set_block(world, chunk, x & (CHUNK_WIDTH - 1), y, z & (CHUNK_WIDTH - 1), id);
+}
+
+static inline uint64_t section_hash(const struct Section *section) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < sizeof(section->blocks); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, (const uint8_t *)section->blocks + i, sizeof(word));
+        h = (h ^ word) * 0x100000001B3ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+static size_t world_find_dedup(const struct World *world, uint64_t hash, const BlockId *blocks) {
+    size_t mask = world->dedup_cap - 1;
+    size_t i = hash & mask;
+    while (world->dedup[i] && (world->dedup[i]->hash != hash
+            || memcmp(world->dedup[i]->blocks, blocks, sizeof(world->dedup[i]->blocks)) != 0)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+static void world_grow_dedup(struct World *world) {
+    MEM_TAG_SCOPE(MEM_TAG_WORLD);
+    struct Section **old = world->dedup;
+    size_t old_cap = world->dedup_cap;
+
+    world->dedup_cap *= 2;
+    world->dedup = mem_alloc(sizeof(*world->dedup) * world->dedup_cap);
+    memset(world->dedup, 0, sizeof(*world->dedup) * world->dedup_cap);
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            size_t j = old[i]->hash & (world->dedup_cap - 1);
+            while (world->dedup[j]) {
+                j = (j + 1) & (world->dedup_cap - 1);
+            }
+            world->dedup[j] = old[i];
+        }
+    }
+    mem_free(old);
+}
+static void world_remove_dedup(struct World *world, struct Section *section) {
+    size_t mask = world->dedup_cap - 1;
+    size_t i = section->hash & mask;
+    while (world->dedup[i] != section) {
+        i = (i + 1) & mask;
+    }
+    i = table_remove_slot(world->dedup, sizeof(*world->dedup), world->dedup_cap, i, dedup_slot_home);
+    world->dedup[i] = NULL;
+    world->num_dedup--;
+    section->deduped = false;
+}
+void section_release(struct World *world, struct Section *section) {
+    assert(section->refs);
+    if (--section->refs) {
+        return;
+    }
+    if (section->deduped) {
+        world_remove_dedup(world, section);
+    }
+    shared_pool_free(world->section_pool, section);
+}
+
+struct Section *chunk_get_writable_section(struct World *world, struct Chunk *chunk, int sy) {
+    struct Section *section = chunk->sections[sy];
+    if (!section) {
+        section = shared_pool_alloc(world->section_pool);
+        assert(section && "Out of memory!");
+        for (int i = 0; i < SECTION_BLOCKS; i++) {
+            section->blocks[i] = chunk->uniform[sy];
+        }
+        section->refs = 1;
+        section->deduped = false;
+        chunk->sections[sy] = section;
+    } else if (section->refs > 1) {
+        // Someone else still needs the old blocks, carry on with a copy
+        struct Section *copy = shared_pool_alloc(world->section_pool);
+        assert(copy && "Out of memory!");
+        memcpy(copy->blocks, section->blocks, sizeof(section->blocks));
+        copy->refs = 1;
+        copy->deduped = false;
+        chunk->sections[sy] = copy;
+        section_release(world, section);
+        section = copy;
+    } else if (section->deduped) {
+        // Only this chunk has it, it just can't stay findable by its old blocks
+        world_remove_dedup(world, section);
+    }
+    return section;
+}
+void chunk_compact(struct World *world, struct Chunk *chunk) {
+    for (int sy = 0; sy < CHUNK_SECTIONS; sy++) {
+        struct Section *section = chunk->sections[sy];
+        if (!section || section->deduped) {
+            continue;
+        }
+
+        bool uniform = true;
+        for (int i = 1; i < SECTION_BLOCKS && uniform; i++) {
+            uniform = section->blocks[i] == section->blocks[0];
+        }
+        if (uniform) {
+            chunk->uniform[sy] = section->blocks[0];
+            chunk->sections[sy] = NULL;
+            section_release(world, section);
+            world->sections_collapsed++;
+            continue;
+        }
+
+        uint64_t hash = section_hash(section);
+        size_t slot = world_find_dedup(world, hash, section->blocks);
+        if (world->dedup[slot]) {
+            section_retain(world->dedup[slot]);
+            chunk->sections[sy] = world->dedup[slot];
+            section_release(world, section);
+            world->sections_merged++;
+            continue;
+        }
+        if ((world->num_dedup + 1) * 10 > world->dedup_cap * 7) {
+            world_grow_dedup(world);
+            slot = world_find_dedup(world, hash, section->blocks);
+        }
+        section->hash = hash;
+        section->deduped = true;
+        world->dedup[slot] = section;
+        world->num_dedup++;
+    }
+}
+static inline bool heightmap_includes(enum Heightmap map, BlockId id) {
+    const struct BlockType *type = block_get(id);
+    switch (map) {
+        case HEIGHTMAP_OPAQUE: return type->opaque;
+        case HEIGHTMAP_MOTION_BLOCKING: return type->blocks_motion;
+        case HEIGHTMAP_SKY: return type->opaque || type->light_filter;
+        default: return false;
+    }
+}
+// Height of the highest matching block at or below y
+static int chunk_scan_height(const struct Chunk *chunk, enum Heightmap map, int x, int y, int z) {
+    while (y >= 0) {
+        const struct Section *section = chunk->sections[y / SECTION_HEIGHT];
+        if (!section) {
+            // One check covers the whole section
+            if (heightmap_includes(map, chunk->uniform[y / SECTION_HEIGHT])) {
+                return y + 1;
+            }
+            y = y / SECTION_HEIGHT * SECTION_HEIGHT - 1;
+            continue;
+        }
+        if (heightmap_includes(map, section->blocks[section_block_index(x, y % SECTION_HEIGHT, z)])) {
+            return y + 1;
+        }
+        y--;
+    }
+    return 0;
+}
+void chunk_build_heightmaps(struct Chunk *chunk) {
+    for (int map = 0; map < HEIGHTMAPS; map++) {
+        for (int z = 0; z < CHUNK_WIDTH; z++) {
+            for (int x = 0; x < CHUNK_WIDTH; x++) {
+                chunk->heightmaps[map][x + z * CHUNK_WIDTH] = chunk_scan_height(chunk, map, x, CHUNK_HEIGHT - 1, z);
+            }
+        }
+    }
+}
+static void chunk_update_heightmaps(struct Chunk *chunk, int x, int y, int z, BlockId id) {
+    for (int map = 0; map < HEIGHTMAPS; map++) {
+        uint16_t *height = &chunk->heightmaps[map][x + z * CHUNK_WIDTH];
+        if (heightmap_includes(map, id)) {
+            if (y >= *height) {
+                *height = y + 1;
+            }
+        } else if (y == *height - 1) {
+            // The top block went away, only now is there anything to scan
+            *height = chunk_scan_height(chunk, map, x, y - 1, z);
+        }
+    }
+}
+// Meshes see one block into the neighbours, edits on the edge show up in theirs
+void chunk_clear_meshed(struct World *world, struct Chunk *chunk, int x, int z) {
+    chunk->meshed = false;
+    const int dx = x == 0 ? -1 : x == CHUNK_WIDTH - 1 ? 1 : 0;
+    const int dz = z == 0 ? -1 : z == CHUNK_WIDTH - 1 ? 1 : 0;
+    if (!dx && !dz) {
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        // Each side on its own and the corner
+        const int nx = i == 1 ? 0 : dx, nz = i == 0 ? 0 : dz;
+        struct Chunk *neighbour = nx || nz ? world_get_chunk(world, chunk->x + nx, chunk->z + nz) : NULL;
+        if (neighbour) {
+            neighbour->meshed = false;
+        }
+    }
+}
+void chunk_set_block(struct World *world, struct Chunk *chunk, int x, int y, int z, BlockId id) {
+    // Before taking a writable section, that would copy a shared one for nothing
+    const BlockId old = chunk_get_block(chunk, x, y, z);
+    if (old == id) {
+        return;
+    }
+    struct Section *section = chunk_get_writable_section(world, chunk, y / SECTION_HEIGHT);
+    section->blocks[section_block_index(x, y % SECTION_HEIGHT, z)] = id;
+    chunk_update_heightmaps(chunk, x, y, z, id);
+    chunk_clear_meshed(world, chunk, x, z);
+    world_mark_dirty(world, chunk);
+    light_block_changed(world, chunk->x * CHUNK_WIDTH + x, y, chunk->z * CHUNK_WIDTH + z, old);
+}
@@ -0,0 +1,217 @@
+#ifndef _WORLD_H
+#define _WORLD_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.h"
+#include "handle.h"
+#include "light.h"
+#include "mem.h"
+
+#define CHUNK_WIDTH 16
+#define SECTION_HEIGHT 16
+#define CHUNK_SECTIONS 16
+#define CHUNK_HEIGHT (SECTION_HEIGHT * CHUNK_SECTIONS)
+#define SECTION_BLOCKS (CHUNK_WIDTH * CHUNK_WIDTH * SECTION_HEIGHT)
+
+struct Section {
+    BlockId blocks[SECTION_BLOCKS];
+    // Chunks and save snapshots using it, whoever writes to a section with
+    // more than one clones it first. Only touched on the main thread.
+    uint32_t refs;
+    // In the world's dedup table under hash, its blocks can't change while
+    // it's there
+    bool deduped;
+    uint64_t hash;
+};
+enum Heightmap {
+    // Highest block light can't get through
+    HEIGHTMAP_OPAQUE,
+    // Highest block entities and rain stop on
+    HEIGHTMAP_MOTION_BLOCKING,
+    // Highest block that takes anything off sky light, opaque or filtering
+    HEIGHTMAP_SKY,
+    HEIGHTMAPS,
+};
+struct Chunk {
+    int32_t x, z;
+    Handle handle;
+    // NULL sections are all uniform, air unless chunk_compact found otherwise
+    struct Section *sections[CHUNK_SECTIONS];
+    BlockId uniform[CHUNK_SECTIONS];
+    // NULL light sections have light_fill everywhere
+    struct SectionLight *light[CHUNK_SECTIONS];
+    uint8_t light_fill[CHUNK_SECTIONS];
+    // Set by light_chunk_init, light doesn't spread into chunks before that
+    bool lit;
+    // One above the highest matching block in each column, 0 if there's none.
+    // Kept up to date by chunk_set_block.
+    uint16_t heightmaps[HEIGHTMAPS][CHUNK_WIDTH * CHUNK_WIDTH];
+    // Its meshes are up to date, block edits here or right next door clear it
+    bool meshed;
+    // Level of detail they were built at, see lod_pick
+    uint8_t lod;
+    // What the streamer's mesh callback keeps its meshes under, 0 for none
+    uint32_t mesh;
+    // Last time the streamer wanted it loaded
+    double wanted_at;
+
+    // A snapshot of it is still being written
+    bool saving;
+    bool dirty;
+    size_t dirty_idx;
+};
+struct ChunkSlot {
+    int32_t x, z;
+    // HANDLE_NULL if the slot is empty
+    Handle handle;
+};
+struct World {
+    // Every loaded chunk, packed together. Anything that outlives a load or
+    // unload holds on to a chunk's handle, not a pointer to it
+    struct HandleTable *chunk_table;
+    // Sections get allocated and freed from whichever thread has them
+    struct SharedPool *section_pool;
+    // Open addressing hash table of sections by content, so chunks with
+    // identical ones share a single copy
+    struct Section **dedup;
+    size_t num_dedup, dedup_cap;
+    // Sections chunk_compact got rid of by sharing or by making them uniform
+    uint64_t sections_merged, sections_collapsed;
+    // Light never leaves the main thread
+    struct Pool *light_pool;
+    struct LightEngine light;
+
+    // Open addressing hash table from chunk position to handle
+    struct ChunkSlot *chunks;
+    size_t num_chunks, chunks_cap;
+
+    // Chunks modified since their last save
+    Handle *dirty;
+    size_t num_dirty, dirty_cap;
+};
+
+// Build with -DSECTION_MORTON to lay sections out in Morton (Z) order, the
+// bits of x, z and y interleaved, so neighbours along y aren't 256 blocks
+// apart. Add -mbmi2 to encode with pdep/pext. Saves don't depend on it.
+#ifdef SECTION_MORTON
+# define SECTION_LAYOUT_NAME "morton"
+# ifdef __BMI2__
+#  include <immintrin.h>
+static inline size_t section_block_index(int x, int y, int z) {
+    return _pdep_u32(x, 0x249) | _pdep_u32(z, 0x492) | _pdep_u32(y, 0x924);
+}
+static inline void section_block_pos(size_t i, int *x, int *y, int *z) {
+    *x = _pext_u32(i, 0x249);
+    *z = _pext_u32(i, 0x492);
+    *y = _pext_u32(i, 0x924);
+}
+# else
+// Moves the low 4 bits of v to every third bit
+static inline uint32_t morton_spread(uint32_t v) {
+    v = (v | v << 4) & 0x0C3;
+    return (v | v << 2) & 0x249;
+}
+static inline uint32_t morton_compact(uint32_t v) {
+    v &= 0x249;
+    v = (v | v >> 2) & 0x0C3;
+    return (v | v >> 4) & 0x00F;
+}
+static inline size_t section_block_index(int x, int y, int z) {
+    return morton_spread(x) | morton_spread(z) << 1 | morton_spread(y) << 2;
+}
+static inline void section_block_pos(size_t i, int *x, int *y, int *z) {
+    *x = morton_compact(i);
+    *z = morton_compact(i >> 1);
+    *y = morton_compact(i >> 2);
+}
+# endif
+#else
+# define SECTION_LAYOUT_NAME "linear"
+static inline size_t section_block_index(int x, int y, int z) {
+    return x + z * CHUNK_WIDTH + y * CHUNK_WIDTH * CHUNK_WIDTH;
+}
+static inline void section_block_pos(size_t i, int *x, int *y, int *z) {
+    *x = i % CHUNK_WIDTH;
+    *z = i / CHUNK_WIDTH % CHUNK_WIDTH;
+    *y = i / (CHUNK_WIDTH * CHUNK_WIDTH);
+}
+#endif
+static inline int32_t world_to_chunk(int32_t v) {
+    return v >> 4;
+}
+// For tables keyed by chunk position
+static inline size_t chunk_pos_hash(int32_t x, int32_t z) {
+    uint64_t h = (uint64_t)(uint32_t)x * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uint32_t)z * 0xC2B2AE3D27D4EB4Full;
+    return (size_t)(h ^ (h >> 32));
+}
+// Slot an entry of an open addressing table hashes to, SIZE_MAX for an empty slot
+typedef size_t(*TableHomeFunc)(const void *slot, size_t mask);
+// Backward shift deletion for open addressing tables with linear probing and
+// a power of two cap. Empties slot i by moving later entries of its probe
+// run back, so lookups never stop at a gap. Returns the slot that's left
+// over, the caller clears it.
+size_t table_remove_slot(void *slots, size_t elem_size, size_t cap, size_t i, TableHomeFunc home);
+
+// Will never return NULL world
+struct World *world_create(void);
+void world_destroy(struct World *world);
+// Gives memory from unloaded chunks back, call it every so often from the main thread
+void world_trim(struct World *world);
+void world_print_stats(const struct World *world);
+// Chunk pointers are only good until the next chunk is loaded or unloaded
+struct Chunk *world_get_chunk(struct World *world, int32_t x, int32_t z);
+// NULL if the chunk was unloaded since
+static inline struct Chunk *world_get_chunk_by_handle(struct World *world, Handle handle) {
+    return handle_table_get(world->chunk_table, handle);
+}
+// Creates an empty (all air) chunk if it isn't loaded yet
+struct Chunk *world_load_chunk(struct World *world, int32_t x, int32_t z);
+// Unsaved changes are dropped, snapshot the chunk first to keep them
+void world_unload_chunk(struct World *world, struct Chunk *chunk);
+void world_mark_dirty(struct World *world, struct Chunk *chunk);
+void world_clear_dirty(struct World *world, struct Chunk *chunk);
+BlockId world_get_block(struct World *world, int32_t x, int32_t y, int32_t z);
+void world_set_block(struct World *world, int32_t x, int32_t y, int32_t z, BlockId id);
+// 0 in chunks that aren't loaded
+int world_get_height(struct World *world, enum Heightmap map, int32_t x, int32_t z);
+
+static inline BlockId chunk_get_block(const struct Chunk *chunk, int x, int y, int z) {
+    const struct Section *section = chunk->sections[y / SECTION_HEIGHT];
+    if (!section) {
+        return chunk->uniform[y / SECTION_HEIGHT];
+    }
+    return section->blocks[section_block_index(x, y % SECTION_HEIGHT, z)];
+}
+static inline uint8_t chunk_get_light(const struct Chunk *chunk, int x, int y, int z) {
+    const struct SectionLight *light = chunk->light[y / SECTION_HEIGHT];
+    if (!light) {
+        return chunk->light_fill[y / SECTION_HEIGHT];
+    }
+    return light->levels[section_block_index(x, y % SECTION_HEIGHT, z)];
+}
+static inline int chunk_get_height(const struct Chunk *chunk, enum Heightmap map, int x, int z) {
+    return chunk->heightmaps[map][x + z * CHUNK_WIDTH];
+}
+// Recomputes every heightmap, call it after writing blocks straight into
+// sections (loading, generation) and before light_chunk_init
+void chunk_build_heightmaps(struct Chunk *chunk);
+// Queues a relight of the block too, see light_update
+void chunk_set_block(struct World *world, struct Chunk *chunk, int x, int y, int z, BlockId id);
+// Something at column (x, z) changed that meshes show (a block or its
+// light), so the chunk and any neighbour that sees the column need remeshing
+void chunk_clear_meshed(struct World *world, struct Chunk *chunk, int x, int z);
+// Returns a section that can be written to, cloning it if it's shared and
+// creating it (filled with the uniform block) if it doesn't exist yet
+struct Section *chunk_get_writable_section(struct World *world, struct Chunk *chunk, int sy);
+// Drops sections that are all one block and swaps the rest for identical
+// ones already in use elsewhere. Call it after filling sections in directly.
+void chunk_compact(struct World *world, struct Chunk *chunk);
+// Frees the section once nothing uses it anymore
+void section_release(struct World *world, struct Section *section);
+static inline void section_retain(struct Section *section) {
+    section->refs++;
+}
+
+#endif